@@ -0,0 +1,276 @@
+#include "batchedudp.hh"
+#include "logger.hh"
+
+#include <QSocketNotifier>
+#include <QtEndian>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+
+/* ******************************************************************************************** *
+ * Implementation of BatchedUdpTransport
+ * ******************************************************************************************** */
+BatchedUdpTransport::BatchedUdpTransport(size_t batchSize, QObject *parent)
+  : UdpTransport(parent)
+#ifdef __linux__
+  , _fd(-1), _readNotifier(0), _writeNotifier(0), _txHead(0), _txTail(0), _flushTimer()
+#endif
+{
+  UdpTransport::setBatchSize(batchSize);
+#ifdef __linux__
+  // Flush the send queue once the control returns to the event loop
+  _flushTimer.setInterval(0);
+  _flushTimer.setSingleShot(true);
+  connect(&_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+#endif
+}
+
+BatchedUdpTransport::~BatchedUdpTransport() {
+#ifdef __linux__
+  if (0 <= _fd) {
+    flush();
+    ::close(_fd);
+  }
+#endif
+}
+
+bool
+BatchedUdpTransport::bind(const QHostAddress &addr, uint16_t port) {
+#ifdef __linux__
+  if (0 <= _fd) {
+    logError() << "BatchedUdpTransport: Socket already bound.";
+    return false;
+  }
+
+  // Assemble local address, IPv4 addresses are mapped into the IPv6 space
+  sockaddr_in6 local; memset(&local, 0, sizeof(sockaddr_in6));
+  local.sin6_family = AF_INET6;
+  local.sin6_port   = htons(port);
+  if ((QHostAddress(QHostAddress::Any) == addr) || (QHostAddress(QHostAddress::AnyIPv6) == addr)) {
+    local.sin6_addr = in6addr_any;
+  } else {
+    memcpy(local.sin6_addr.s6_addr, addr.toIPv6Address().c, 16);
+  }
+
+  // Create a non-blocking dual-stack socket
+  if (0 > (_fd = ::socket(AF_INET6, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0))) {
+    logError() << "BatchedUdpTransport: Cannot create socket: " << strerror(errno);
+    return false;
+  }
+  int v6only = 0;
+  setsockopt(_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+  if (0 > ::bind(_fd, (const sockaddr *)&local, sizeof(sockaddr_in6))) {
+    logError() << "BatchedUdpTransport: Cannot bind to " << addr << ":" << port
+               << ": " << strerror(errno);
+    ::close(_fd); _fd = -1;
+    return false;
+  }
+
+  // Allocate message headers and send queue
+  setBatchSize(_batchSize);
+
+  _readNotifier = new QSocketNotifier(_fd, QSocketNotifier::Read, this);
+  connect(_readNotifier, SIGNAL(activated(int)), this, SLOT(_onReadable()));
+  _writeNotifier = new QSocketNotifier(_fd, QSocketNotifier::Write, this);
+  _writeNotifier->setEnabled(false);
+  connect(_writeNotifier, SIGNAL(activated(int)), this, SLOT(_onWritable()));
+  return true;
+#else
+  return UdpTransport::bind(addr, port);
+#endif
+}
+
+bool
+BatchedUdpTransport::isBound() const {
+#ifdef __linux__
+  return (0 <= _fd);
+#else
+  return UdpTransport::isBound();
+#endif
+}
+
+QHostAddress
+BatchedUdpTransport::localAddress() const {
+#ifdef __linux__
+  sockaddr_in6 local; socklen_t len = sizeof(sockaddr_in6);
+  if ((0 > _fd) || (0 > getsockname(_fd, (sockaddr *)&local, &len))) {
+    return QHostAddress();
+  }
+  if (IN6_IS_ADDR_V4MAPPED(&local.sin6_addr)) {
+    return QHostAddress(qFromBigEndian<quint32>(local.sin6_addr.s6_addr+12));
+  }
+  return QHostAddress((const quint8 *)local.sin6_addr.s6_addr);
+#else
+  return UdpTransport::localAddress();
+#endif
+}
+
+uint16_t
+BatchedUdpTransport::localPort() const {
+#ifdef __linux__
+  sockaddr_in6 local; socklen_t len = sizeof(sockaddr_in6);
+  if ((0 > _fd) || (0 > getsockname(_fd, (sockaddr *)&local, &len))) {
+    return 0;
+  }
+  return ntohs(local.sin6_port);
+#else
+  return UdpTransport::localPort();
+#endif
+}
+
+void
+BatchedUdpTransport::setBatchSize(size_t n) {
+  UdpTransport::setBatchSize(n);
+#ifdef __linux__
+  _rxMsgs.resize(_batchSize); _rxIov.resize(_batchSize); _rxAddr.resize(_batchSize);
+  // Move datagrams, that cannot be send now, to the front of the send queue. They are kept even if
+  // the queue shrinks below their number.
+  flush();
+  size_t queued = _txTail-_txHead;
+  for (size_t i=0; i<queued; i++) {
+    _txQueue[i] = _txQueue[_txHead+i];
+    _txIov[i].iov_len = _txIov[_txHead+i].iov_len;
+  }
+  _txHead = 0; _txTail = queued;
+  size_t txSize = std::max(_batchSize, queued);
+  _txQueue.resize(txSize); _txMsgs.resize(txSize); _txIov.resize(txSize);
+  // Link message headers to their buffers
+  for (size_t i=0; i<txSize; i++) {
+    memset(&_txMsgs[i], 0, sizeof(mmsghdr));
+    _txIov[i].iov_base = _txQueue[i].data;
+    _txMsgs[i].msg_hdr.msg_iov = &_txIov[i];
+    _txMsgs[i].msg_hdr.msg_iovlen = 1;
+    _txMsgs[i].msg_hdr.msg_name = &_txQueue[i].addr;
+    _txMsgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in6);
+  }
+#endif
+}
+
+size_t
+BatchedUdpTransport::receive(Datagram *batch, size_t n) {
+#ifdef __linux__
+  if (0 > _fd) { return 0; }
+  n = std::min(n, size_t(_rxMsgs.size()));
+  // Point message headers to the given buffers
+  for (size_t i=0; i<n; i++) {
+    memset(&_rxMsgs[i], 0, sizeof(mmsghdr));
+    _rxIov[i].iov_base = batch[i].data;
+    _rxIov[i].iov_len  = OVL_MAX_MESSAGE_SIZE;
+    _rxMsgs[i].msg_hdr.msg_iov = &_rxIov[i];
+    _rxMsgs[i].msg_hdr.msg_iovlen = 1;
+    _rxMsgs[i].msg_hdr.msg_name = &_rxAddr[i];
+    _rxMsgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in6);
+  }
+
+  int res = 0;
+  do {
+    res = recvmmsg(_fd, _rxMsgs.data(), n, MSG_DONTWAIT, 0);
+  } while ((0 > res) && (EINTR == errno));
+  if (0 >= res) {
+    if ((0 > res) && (EAGAIN != errno) && (EWOULDBLOCK != errno)) {
+      logError() << "BatchedUdpTransport: recvmmsg() failed: " << strerror(errno);
+    }
+    return 0;
+  }
+
+  _rxCalls++; _rxDatagrams += res;
+  for (int i=0; i<res; i++) {
+    batch[i].size = _rxMsgs[i].msg_len;
+    // Mark truncated datagrams as too large
+    if (_rxMsgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      batch[i].size = OVL_MAX_MESSAGE_SIZE+1;
+    }
+    const sockaddr_in6 &src = _rxAddr[i];
+    if (IN6_IS_ADDR_V4MAPPED(&src.sin6_addr)) {
+      batch[i].addr.setAddress(qFromBigEndian<quint32>(src.sin6_addr.s6_addr+12));
+    } else {
+      batch[i].addr.setAddress((const quint8 *)src.sin6_addr.s6_addr);
+    }
+    batch[i].port = ntohs(src.sin6_port);
+  }
+  return res;
+#else
+  return UdpTransport::receive(batch, n);
+#endif
+}
+
+bool
+BatchedUdpTransport::send(const uint8_t *data, size_t len, const QHostAddress &addr, uint16_t port) {
+  if (len > OVL_MAX_MESSAGE_SIZE) { return false; }
+#ifdef __linux__
+  if (0 > _fd) { return false; }
+  // If the queue is full -> send queued datagrams first
+  if (_txTail == size_t(_txQueue.size())) {
+    flush();
+    if (_txTail == size_t(_txQueue.size())) { return false; }
+  }
+  // Append to queue
+  OutDatagram &out = _txQueue[_txTail];
+  memcpy(out.data, data, len);
+  memset(&out.addr, 0, sizeof(sockaddr_in6));
+  out.addr.sin6_family = AF_INET6;
+  out.addr.sin6_port = htons(port);
+  memcpy(out.addr.sin6_addr.s6_addr, addr.toIPv6Address().c, 16);
+  _txIov[_txTail].iov_len = len;
+  _txTail++;
+  // Flush queue once the control returns to the event loop, unless the kernel buffer is full
+  if ((! _flushTimer.isActive()) && (! _writeNotifier->isEnabled())) {
+    _flushTimer.start();
+  }
+  return true;
+#else
+  return UdpTransport::send(data, len, addr, port);
+#endif
+}
+
+void
+BatchedUdpTransport::flush() {
+#ifdef __linux__
+  qint64 bytes = 0;
+  while (_txHead < _txTail) {
+    int res = sendmmsg(_fd, _txMsgs.data()+_txHead, _txTail-_txHead, 0);
+    if (0 > res) {
+      if (EINTR == errno) { continue; }
+      if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (ENOBUFS == errno)) {
+        // Kernel buffer is full -> continue once the socket gets writable
+        _writeNotifier->setEnabled(true);
+        break;
+      }
+      logError() << "BatchedUdpTransport: sendmmsg() failed: " << strerror(errno);
+      // Drop the datagram that cannot be send and continue with the next one
+      _txHead++;
+      continue;
+    }
+    _txCalls++; _txDatagrams += res;
+    for (int i=0; i<res; i++) {
+      bytes += _txMsgs[_txHead+i].msg_len;
+    }
+    _txHead += res;
+  }
+  // Reset queue if empty
+  if (_txHead == _txTail) {
+    _txHead = _txTail = 0;
+  }
+  if (bytes) {
+    emit bytesWritten(bytes);
+  }
+#endif
+}
+
+void
+BatchedUdpTransport::_onReadable() {
+  emit readyRead();
+}
+
+void
+BatchedUdpTransport::_onWritable() {
+#ifdef __linux__
+  _writeNotifier->setEnabled(false);
+  flush();
+#endif
+}
@@ -0,0 +1,103 @@
+#ifndef __OVL_BATCHEDUDP_HH__
+#define __OVL_BATCHEDUDP_HH__
+
+#include "transport.hh"
+
+#include <QVector>
+#include <QTimer>
+
+#include <inttypes.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+// Forward declarations
+class QSocketNotifier;
+
+
+/** A UDP socket receiving and sending datagrams in batches.
+ *
+ * Under Linux, up to @c batchSize datagrams are received with a single @c recvmmsg call. Outgoing
+ * datagrams are queued and send with a single @c sendmmsg call once the control returns to the
+ * event loop or once the queue is full. This reduces the number of system calls significantly on
+ * busy nodes. On other platforms, it behaves like the @c UdpTransport it is derived from. Pass an
+ * instance to the @c Node constructor to enable batching.
+ * @ingroup internal */
+class BatchedUdpTransport: public UdpTransport
+{
+  Q_OBJECT
+
+public:
+  /** Constructor.
+   * @param batchSize Specifies the maximum number of datagrams per system call.
+   * @param parent Optional QObject parent. */
+  explicit BatchedUdpTransport(size_t batchSize=OVL_DEFAULT_IO_BATCH_SIZE, QObject *parent=0);
+  /** Destructor, sends all queued datagrams and closes the socket. */
+  virtual ~BatchedUdpTransport();
+
+  bool bind(const QHostAddress &addr, uint16_t port);
+  bool isBound() const;
+  QHostAddress localAddress() const;
+  uint16_t localPort() const;
+
+  /** Sets the maximum number of datagrams received or send with a single system call. */
+  void setBatchSize(size_t n);
+
+  size_t receive(Datagram *batch, size_t n);
+  /** Queues a datagram to be send to the given address and port.
+   * Returns @c false if the datagram cannot be send. */
+  bool send(const uint8_t *data, size_t len, const QHostAddress &addr, uint16_t port);
+
+public slots:
+  /** Sends all queued datagrams. */
+  void flush();
+
+private slots:
+  /** Gets called if the socket gets readable. */
+  void _onReadable();
+  /** Gets called if the socket gets writable again. */
+  void _onWritable();
+
+#ifdef __linux__
+protected:
+  /** An outgoing datagram in the send queue. */
+  struct OutDatagram {
+    /** The datagram data. */
+    uint8_t      data[OVL_MAX_MESSAGE_SIZE];
+    /** The destination address. */
+    sockaddr_in6 addr;
+  };
+#endif
+
+protected:
+#ifdef __linux__
+  /** The socket file descriptor. */
+  int _fd;
+  /** Read notifier. */
+  QSocketNotifier *_readNotifier;
+  /** Write notifier, enabled if the kernel send buffer is full. */
+  QSocketNotifier *_writeNotifier;
+  /** Message headers for @c recvmmsg. */
+  QVector<mmsghdr> _rxMsgs;
+  /** IO vectors for @c recvmmsg. */
+  QVector<iovec> _rxIov;
+  /** Source addresses for @c recvmmsg. */
+  QVector<sockaddr_in6> _rxAddr;
+  /** The send queue. */
+  QVector<OutDatagram> _txQueue;
+  /** Message headers for @c sendmmsg. */
+  QVector<mmsghdr> _txMsgs;
+  /** IO vectors for @c sendmmsg. */
+  QVector<iovec> _txIov;
+  /** Index of the first queued datagram. */
+  size_t _txHead;
+  /** Index past the last queued datagram. */
+  size_t _txTail;
+  /** Single-shot timer to flush the send queue on the next event-loop iteration. */
+  QTimer _flushTimer;
+#endif
+};
+
+#endif // __OVL_BATCHEDUDP_HH__
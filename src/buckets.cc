@@ -2,6 +2,13 @@
 #include "crypto.hh"
 #include <inttypes.h>
 #include <QChar>
+#include <QtEndian>
+#include <algorithm>
+#include <cstdlib>
+
+/** A confirmed replacement takes the place of the slowest node of a full bucket, if its RTT is
+ * less than the RTT of the slowest node divided by this ratio. */
+#define BUCKET_PROXIMITY_RATIO 2
 
 char bits_to_base32(uint8_t val) {
   if ((val >= 0) && (val<=25)) { return ('a'+val); }
@@ -20,46 +27,25 @@ uint8_t base32_to_bits(char c) {
  * Implementation of Identifier
  * ******************************************************************************************** */
 Identifier::Identifier()
-  : QByteArray()
+  : _valid(false)
 {
-  // pass...
+  memset(_data.bytes, 0, OVL_HASH_SIZE);
 }
 
 Identifier::Identifier(const char *id)
-  : QByteArray(id, OVL_HASH_SIZE)
+  : _valid(true)
 {
-  // pass...
+  memcpy(_data.bytes, id, OVL_HASH_SIZE);
 }
 
 Identifier::Identifier(const QByteArray &id)
-  : QByteArray(id)
-{
-  // pass...
-}
-
-Identifier::Identifier(const Identifier &other)
-  : QByteArray(other)
+  : _valid(OVL_HASH_SIZE == id.size())
 {
-  // pass...
-}
-
-Identifier &
-Identifier::operator=(const Identifier &other) {
-  QByteArray::operator=(other);
-  return *this;
-}
-
-bool
-Identifier::operator==(const Identifier &other) const {
-  for (size_t i=0; i<OVL_HASH_SIZE; i++) {
-    if (this->at(i) ^ other.at(i)) { return false; }
+  if (_valid) {
+    memcpy(_data.bytes, id.constData(), OVL_HASH_SIZE);
+  } else {
+    memset(_data.bytes, 0, OVL_HASH_SIZE);
   }
-  return true;
-}
-
-Distance
-Identifier::operator-(const Identifier &other) const {
-  return Distance(*this, other);
 }
 
 bool
@@ -67,32 +53,43 @@ Identifier::isNull() const {
   return isValid() && (Identifier::null() == *this);
 }
 
-bool
-Identifier::isValid() const {
-  return (OVL_HASH_SIZE == this->size());
+QByteArray
+Identifier::toByteArray() const {
+  if (! _valid) { return QByteArray(); }
+  return QByteArray(constData(), OVL_HASH_SIZE);
 }
 
 Identifier
 Identifier::create() {
   Identifier id;
-  id.reserve(OVL_HASH_SIZE);
   for (int i=0; i<OVL_HASH_SIZE; i++) {
-    id.append(qrand() % 0xff);
+    id._data.bytes[i] = qrand() % 0xff;
   }
+  id._valid = true;
   return id;
 }
 
 Identifier
 Identifier::null() {
-  Identifier id; id.reserve(OVL_HASH_SIZE);
-  OVLHash((const uint8_t *)"", 0, (uint8_t *)id.data());
+  Identifier id;
+  OVLHash((const uint8_t *)"", 0, id._data.bytes);
+  id._valid = true;
+  return id;
+}
+
+Identifier
+Identifier::fromName(const QString &name) {
+  Identifier id;
+  QByteArray utf8 = name.toUtf8();
+  OVLHash((const uint8_t *)utf8.constData(), utf8.size(), id._data.bytes);
+  id._valid = true;
   return id;
 }
 
 QString
 Identifier::toBase32() const {
-  // Ensure we have the correct length
-  if (OVL_HASH_SIZE != size()) { return ""; }
+  // Ensure we have a valid identifier
+  if (! _valid) { return ""; }
   // Get the number of chars to encode HASH as base32 (no padding, we know the length)
   size_t sc = ((OVL_HASH_SIZE*8/5) + (((OVL_HASH_SIZE*8)%5) ? 1 : 0));
   QString code; code.reserve(sc);
@@ -102,15 +99,15 @@ Identifier::toBase32() const {
     uint8_t val = 0;
     if (msb>3) {
       // If the 5-bits are within this byte entirely
-      val = (((uint8_t *)constData())[byte]>>(msb-4));
+      val = (_data.bytes[byte]>>(msb-4));
     } else {
       // If the 5-bits span into the next byte:
       //  take the first (msb+1) bits from this byte
-      val = (((uint8_t *)constData())[byte]<<(4-msb));
+      val = (_data.bytes[byte]<<(4-msb));
       // If there is a next byte
-      if ((byte+1) < size_t(size())) {
+      if ((byte+1) < OVL_HASH_SIZE) {
         // take the first (4-msb) bits from the
-        val |= (((uint8_t *)constData())[byte+1]>>(4+msb));
+        val |= (_data.bytes[byte+1]>>(4+msb));
       }
     }
     code.append(bits_to_base32(val & 0x1f));
@@ -123,20 +120,20 @@ Identifier::fromBase32(const QString &base32) {
   Identifier id;
   // Get the number of chars to decode from base32 (no padding, we know the expected length)
   size_t sc = std::min(base32.size(), ((OVL_HASH_SIZE*8/5)+((OVL_HASH_SIZE*8)%5 ? 1 : 0)));
-  id.resize(OVL_HASH_SIZE); id.fill(0, OVL_HASH_SIZE);
+  id._valid = true;
   for (size_t i=0; i<sc; i++) {
     // Get byte and msb of the i-th 5-bit symbol in a byte.
     size_t byte = (i*5)/8, msb = (7 - ((i*5)%8));
     uint8_t val = base32_to_bits(base32.at(i).toLatin1());
     if (msb>3) {
       // If the 5-bits are within this byte entirely
-      ((uint8_t *)id.constData())[byte] |= (val<<(msb-4));
+      id._data.bytes[byte] |= (val<<(msb-4));
     } else {
       // But the first msb+1 bits of this value into buffer
-      ((uint8_t *)id.constData())[byte] |= (val>>(4-msb));
+      id._data.bytes[byte] |= (val>>(4-msb));
       // If there is a next byte
-      if ((byte+1) < size_t(id.size())) {
-        ((uint8_t *)id.constData())[byte+1] |= (val<<(4+msb));
+      if ((byte+1) < OVL_HASH_SIZE) {
+        id._data.bytes[byte+1] |= (val<<(4+msb));
       }
     }
   }
@@ -146,30 +143,22 @@ Identifier::fromBase32(const QString &base32) {
 /* ******************************************************************************************** *
  * Implementation of Distance
  * ******************************************************************************************** */
-Distance::Distance(const Identifier &a, const Identifier &b)
-  : QByteArray(OVL_HASH_SIZE, 0xff)
+Distance::Distance()
 {
-  for (uint i=0; i<OVL_HASH_SIZE; i++) {
-    (*this)[i] = (a[i] ^ b[i]);
-  }
+  memset(_words, 0xff, sizeof(_words));
 }
 
-Distance::Distance(const Distance &distance)
-  : QByteArray(distance)
+Distance::Distance(const Identifier &a, const Identifier &b)
 {
-  // pass...
-}
-
-bool
-Distance::bit(size_t idx) const {
-  size_t byte = idx/8, bit  = (7-(idx%8));
-  return (1 == (this->at(byte) >> bit));
+  for (size_t i=0; i<OVL_HASH_WORDS; i++) {
+    _words[i] = qFromBigEndian<quint32>(a.word(i) ^ b.word(i));
+  }
 }
 
 size_t
 Distance::leadingBit() const {
-  for (size_t i=0; i<(8*OVL_HASH_SIZE); i++) {
-    if (bit(i)) { return i; }
+  for (size_t i=0; i<OVL_HASH_WORDS; i++) {
+    if (_words[i]) { return 32*i + __builtin_clz(_words[i]); }
   }
   return 8*OVL_HASH_SIZE;
 }
@@ -178,38 +167,61 @@ Distance::leadingBit() const {
  * Implementation of PeerItem
  * ******************************************************************************************** */
 PeerItem::PeerItem()
-  : _addr(), _port(0)
+  : _port(0)
 {
-  // pass...
+  memset(_ip, 0, 16);
 }
 
 PeerItem::PeerItem(const QHostAddress &addr, uint16_t port)
-  : _addr(addr), _port(port)
+  : _port(port)
 {
-  // pass...
+  memset(_ip, 0, 16);
+  if (QAbstractSocket::IPv4Protocol == addr.protocol()) {
+    // Map IPv4 address into IPv6 space
+    _ip[10] = _ip[11] = 0xff;
+    qToBigEndian(quint32(addr.toIPv4Address()), _ip+12);
+  } else if (QAbstractSocket::IPv6Protocol == addr.protocol()) {
+    memcpy(_ip, addr.toIPv6Address().c, 16);
+  }
 }
 
-PeerItem::PeerItem(const PeerItem &other)
-  : _addr(other._addr), _port(other._port)
+PeerItem::PeerItem(const uint8_t *ip, uint16_t port)
+  : _port(port)
 {
-  // pass...
+  memcpy(_ip, ip, 16);
 }
 
-PeerItem &
-PeerItem::operator =(const PeerItem &other) {
-  _addr = other._addr;
-  _port = other._port;
-  return *this;
+PeerItem::PeerItem(const sockaddr_in6 &addr)
+  : _port(ntohs(addr.sin6_port))
+{
+  memcpy(_ip, addr.sin6_addr.s6_addr, 16);
 }
 
-const QHostAddress &
+QHostAddress
 PeerItem::addr() const {
-  return _addr;
+  if (isIPv4()) {
+    return QHostAddress(qFromBigEndian<quint32>(_ip+12));
+  }
+  // All-zero address -> null address
+  static const uint8_t zero[16] = {0};
+  if (0 == memcmp(_ip, zero, 16)) {
+    return QHostAddress();
+  }
+  return QHostAddress((const quint8 *)_ip);
 }
 
-uint16_t
-PeerItem::port() const {
-  return _port;
+bool
+PeerItem::isIPv4() const {
+  static const uint8_t prefix[12] = {0,0,0,0,0,0,0,0,0,0,0xff,0xff};
+  return 0 == memcmp(_ip, prefix, 12);
+}
+
+void
+PeerItem::toSockAddr(sockaddr_in6 &addr) const {
+  memset(&addr, 0, sizeof(sockaddr_in6));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_port = htons(_port);
+  memcpy(addr.sin6_addr.s6_addr, _ip, 16);
 }
 
 
@@ -234,36 +246,19 @@ NodeItem::NodeItem(const Identifier &id, const PeerItem &peer)
   // pass...
 }
 
-NodeItem::NodeItem(const NodeItem &other)
-  : PeerItem(other), _id(other._id)
-{
-  // pass...
-}
-
-NodeItem &
-NodeItem::operator =(const NodeItem &other) {
-  PeerItem::operator =(other);
-  _id   = other._id;
-  return *this;
-}
-
-const Identifier &
-NodeItem::id() const {
-  return _id;
-}
 
 
 /* ******************************************************************************************** *
  * Implementation of AnnouncementItem
  * ******************************************************************************************** */
 AnnouncementItem::AnnouncementItem()
-  : PeerItem(), _timestamp()
+  : PeerItem(), _timestamp(0)
 {
   // pass...
 }
 
 AnnouncementItem::AnnouncementItem(const QHostAddress &addr, uint16_t port)
-  : PeerItem(addr, port), _timestamp(QDateTime::currentDateTime())
+  : PeerItem(addr, port), _timestamp(Ticks::now())
 {
   // pass...
 }
@@ -281,9 +276,93 @@ AnnouncementItem::operator =(const AnnouncementItem &other) {
   return *this;
 }
 
+
+/* ******************************************************************************************** *
+ * Implementation of NearestNodes
+ * ******************************************************************************************** */
+NearestNodes::NearestNodes(const Identifier &id)
+  : _id(id), _size(0)
+{
+  // pass...
+}
+
+const Identifier &
+NearestNodes::id() const {
+  return _id;
+}
+
+size_t
+NearestNodes::size() const {
+  return _size;
+}
+
+bool
+NearestNodes::full() const {
+  return size_t(OVL_K) == _size;
+}
+
+bool
+NearestNodes::add(const NodeItem &node) {
+  return add(node.id(), node.peer());
+}
+
 bool
-AnnouncementItem::olderThan(size_t seconds) const {
-  return (_timestamp.addSecs(seconds)<QDateTime::currentDateTime());
+NearestNodes::add(const Identifier &id, const PeerItem &peer) {
+  Distance d = _id - id;
+  if (! full()) {
+    // Append and restore heap
+    _distances[_size] = d;
+    _nodes[_size] = NodeItem(id, peer);
+    siftUp(_size++);
+    return true;
+  }
+  // If the node is not closer than the farthest selected one -> skip
+  if (d >= _distances[0]) { return false; }
+  // Replace farthest node and restore heap
+  _distances[0] = d;
+  _nodes[0] = NodeItem(id, peer);
+  siftDown(0);
+  return true;
+}
+
+void
+NearestNodes::nodes(QList<NodeItem> &lst) const {
+  // Sort selected nodes by distance, there are at most OVL_K of them
+  size_t order[OVL_MAX_K];
+  for (size_t i=0; i<_size; i++) {
+    size_t j = i;
+    for (; (j>0) && (_distances[i] < _distances[order[j-1]]); j--) {
+      order[j] = order[j-1];
+    }
+    order[j] = i;
+  }
+  for (size_t i=0; i<_size; i++) {
+    lst.append(_nodes[order[i]]);
+  }
+}
+
+void
+NearestNodes::siftUp(size_t idx) {
+  while (idx > 0) {
+    size_t parent = (idx-1)/2;
+    if (! (_distances[parent] < _distances[idx])) { return; }
+    std::swap(_distances[parent], _distances[idx]);
+    std::swap(_nodes[parent], _nodes[idx]);
+    idx = parent;
+  }
+}
+
+void
+NearestNodes::siftDown(size_t idx) {
+  while (true) {
+    size_t largest = idx, left = 2*idx+1, right = 2*idx+2;
+    if ((left < _size) && (_distances[largest] < _distances[left])) { largest = left; }
+    if ((right < _size) && (_distances[largest] < _distances[right])) { largest = right; }
+    if (largest == idx) { return; }
+    std::swap(_distances[largest], _distances[idx]);
+    std::swap(_nodes[largest], _nodes[idx]);
+    idx = largest;
+  }
 }
 
 
@@ -291,31 +370,41 @@ AnnouncementItem::olderThan(size_t seconds) const {
  * Implementation of Bucket::Item
  * ******************************************************************************************** */
 Bucket::Item::Item()
-  : _prefix(0), _peer(QHostAddress(), 0), _lastSeen()
+  : _id(), _prefix(0), _peer(), _lastSeen(0), _srtt(-1), _rttvar(-1)
 {
   // pass...
 }
 
-Bucket::Item::Item(const QHostAddress &addr, uint16_t port, size_t prefix, const QDateTime &lastSeen)
-  : _prefix(prefix), _peer(addr, port), _lastSeen(lastSeen)
+Bucket::Item::Item(const Identifier &id, const PeerItem &peer, size_t prefix,
+                   uint32_t lastSeen)
+  : _id(id), _prefix(prefix), _peer(peer), _lastSeen(lastSeen), _srtt(-1), _rttvar(-1)
 {
   // pass...
 }
 
 Bucket::Item::Item(const Item &other)
-  : _prefix(other._prefix), _peer(other._peer), _lastSeen(other._lastSeen)
+  : _id(other._id), _prefix(other._prefix), _peer(other._peer), _lastSeen(other._lastSeen),
+    _srtt(other._srtt), _rttvar(other._rttvar)
 {
   // pass...
 }
 
 Bucket::Item &
 Bucket::Item::operator =(const Item &other) {
+  _id        = other._id;
   _prefix    = other._prefix;
   _peer      = other._peer;
   _lastSeen  = other._lastSeen;
+  _srtt      = other._srtt;
+  _rttvar    = other._rttvar;
   return *this;
 }
 
+const Identifier &
+Bucket::Item::id() const {
+  return _id;
+}
+
 size_t
 Bucket::Item::prefix() const {
   return _prefix;
@@ -326,7 +415,7 @@ Bucket::Item::peer() const {
   return _peer;
 }
 
-const QHostAddress &
+QHostAddress
 Bucket::Item::addr() const {
   return _peer.addr();
 }
@@ -336,155 +425,354 @@ Bucket::Item::port() const {
   return _peer.port();
 }
 
-const QDateTime &
+uint32_t
 Bucket::Item::lastSeen() const {
   return _lastSeen;
 }
 
+void
+Bucket::Item::update(const PeerItem &peer) {
+  // If the node moved, the RTT estimate is meaningless
+  if (_peer != peer) {
+    _peer = peer;
+    _srtt = _rttvar = -1;
+  }
+  _lastSeen = Ticks::now();
+}
+
+void
+Bucket::Item::addRttSample(int ms) {
+  if (0 > ms) { return; }
+  if (! hasRtt()) {
+    // First measurement
+    _srtt = ms; _rttvar = ms/2;
+  } else {
+    // RTTVAR <- 3/4 RTTVAR + 1/4 |SRTT-R|, SRTT <- 7/8 SRTT + 1/8 R
+    _rttvar = (3*_rttvar + std::abs(_srtt-ms))/4;
+    _srtt   = (7*_srtt + ms)/8;
+  }
+}
+
 
 /* ******************************************************************************************** *
  * Implementation of Bucket
  * ******************************************************************************************** */
-Bucket::Bucket(const Identifier &self)
-  : _self(self), _maxSize(OVL_K), _prefix(0), _triples()
+Bucket::Bucket()
+  : _self(), _maxSize(OVL_K), _prefix(0), _items(), _replacements()
 {
   // pass...
 }
 
+Bucket::Bucket(const Identifier &self, size_t prefix)
+  : _self(self), _maxSize(OVL_K), _prefix(prefix), _items(), _replacements()
+{
+  _items.reserve(_maxSize);
+}
+
 Bucket::Bucket(const Bucket &other)
-  : _self(other._self), _maxSize(other._maxSize), _prefix(other._prefix), _triples(other._triples)
+  : _self(other._self), _maxSize(other._maxSize), _prefix(other._prefix), _items(other._items),
+    _replacements(other._replacements)
 {
   // pass...
 }
 
+Bucket &
+Bucket::operator =(const Bucket &other) {
+  _self    = other._self;
+  _maxSize = other._maxSize;
+  _prefix  = other._prefix;
+  _items   = other._items;
+  _replacements = other._replacements;
+  return *this;
+}
+
+int
+Bucket::find(const Identifier &id) const {
+  for (int i=0; i<_items.size(); i++) {
+    if (_items[i].id() == id) { return i; }
+  }
+  return -1;
+}
+
 bool
 Bucket::full() const {
-  return int(_maxSize)==_triples.size();
+  return int(_maxSize)==_items.size();
 }
 
 size_t
 Bucket::numNodes() const {
-  return _triples.size();
+  return _items.size();
+}
+
+size_t
+Bucket::numReplacements() const {
+  return _replacements.size();
 }
 
 void
 Bucket::nodes(QList<NodeItem> &lst) const {
-  QHash<Identifier, Item>::const_iterator item = _triples.begin();
-  for (; item != _triples.end(); item++) {
-    lst.push_back(NodeItem(item.key(), item->addr(), item->port()));
+  QVector<Item>::const_iterator item = _items.begin();
+  for (; item != _items.end(); item++) {
+    lst.push_back(NodeItem(item->id(), item->peer()));
+  }
+}
+
+void
+Bucket::items(QList<Item> &lst) const {
+  QVector<Item>::const_iterator item = _items.begin();
+  for (; item != _items.end(); item++) {
+    lst.push_back(*item);
   }
 }
 
 bool
 Bucket::contains(const Identifier &id) const {
-  return _triples.contains(id);
+  return 0 <= find(id);
 }
 
 bool
 Bucket::isValid(const Identifier &id) const {
-  return _triples[id].lastSeen().isValid();
+  int idx = find(id);
+  if (0 > idx) { return false; }
+  return _items[idx].isValid();
 }
 
 NodeItem
 Bucket::getNode(const Identifier &id) const {
-  if (_triples.contains(id)) {
-    return NodeItem(id, _triples[id].addr(), _triples[id].port());
-  }
-  return NodeItem();
+  int idx = find(id);
+  if (0 > idx) { return NodeItem(); }
+  return NodeItem(id, _items[idx].peer());
 }
 
 bool
-Bucket::add(const Identifier &id, const Item &item) {
-  _triples[id] = item;
-  return true;
-}
-
-bool
-Bucket::add(const Identifier &id, const QHostAddress &addr, uint16_t port) {
-  bool isNew = !contains(id);
-  if (contains(id) || (!full())) {
-    _triples[id] = Item(addr, port, (id-_self).leadingBit(), QDateTime::currentDateTime());
+Bucket::add(const NodeItem &node) {
+  int idx = find(node.id());
+  if (0 <= idx) {
+    _items[idx].update(node.peer());
+    return false;
+  }
+  if (! full()) {
+    _items.append(Item(node.id(), node.peer(), _prefix, Ticks::now()));
     //logDebug() << "Node " << addr << ":" << port << " entered buckets.";
-    return isNew;
+    return true;
   }
+  // Bucket is full -> keep node as a replacement for silent nodes
+  addReplacement(Item(node.id(), node.peer(), _prefix, Ticks::now()));
   return false;
 }
 
 void
-Bucket::addCandidate(const Identifier &id, const QHostAddress &addr, uint16_t port) {
-  if ((!contains(id)) && (!full())) {
+Bucket::addCandidate(const NodeItem &node) {
+  if (contains(node.id())) { return; }
+  if (! full()) {
     // Add item with invalid timestamp -> it is a candidate and will be removed soon
     // also items with invalid timestamp are not returned by a findNode request
-    _triples[id] = Item(addr, port, (id-_self).leadingBit(), QDateTime());
+    _items.append(Item(node.id(), node.peer(), _prefix));
+  } else {
+    addReplacement(Item(node.id(), node.peer(), _prefix));
   }
 }
 
-
-size_t
-Bucket::prefix() const {
-  return _prefix;
+void
+Bucket::addReplacement(const Item &item) {
+  Item updated(item);
+  for (int i=0; i<_replacements.size(); i++) {
+    if (_replacements[i].id() != item.id()) { continue; }
+    // Do not downgrade a confirmed replacement to a candidate
+    if ((! item.isValid()) && _replacements[i].isValid()) { return; }
+    // Keep the RTT estimate unless the node moved
+    if ((! item.hasRtt()) && _replacements[i].hasRtt() && (item.peer() == _replacements[i].peer())) {
+      updated.setRtt(_replacements[i].rtt(), _replacements[i].rttVar());
+    }
+    _replacements.remove(i);
+    break;
+  }
+  if (_replacements.size() >= int(_maxSize)) {
+    _replacements.remove(0);
+  }
+  _replacements.append(updated);
 }
 
 void
-Bucket::split(Bucket &newBucket) {
-  // Add all items from this bucket to the new one, which have a higher
-  // prefix than the prefix of this bucket
-  QHash<Identifier, Item>::iterator item = _triples.begin();
-  for (; item != _triples.end(); item++) {
-    if (item->prefix() > _prefix) {
-      newBucket.add(item.key(), *item);
+Bucket::pruneReplacements() {
+  for (int i=_replacements.size()-1; i>=0; i--) {
+    if (contains(_replacements[i].id())) { _replacements.remove(i); }
+  }
+}
+
+bool
+Bucket::promoteReplacement(NodeItem &node) {
+  pruneReplacements();
+  if (_replacements.isEmpty() || full()) { return false; }
+  // Prefer the fastest confirmed node, otherwise take the most recent one
+  int idx = _replacements.size()-1;
+  for (int i=_replacements.size()-2; i>=0; i--) {
+    const Item &item = _replacements[i], &best = _replacements[idx];
+    if (! item.isValid()) { continue; }
+    if ((! best.isValid()) ||
+        (item.hasRtt() && ((! best.hasRtt()) || (item.rtt() < best.rtt())))) {
+      idx = i;
     }
   }
-  item = newBucket._triples.begin();
-  for (; item != newBucket._triples.end(); item++) {
-    _triples.remove(item.key());
+  _items.append(_replacements[idx]);
+  _replacements.remove(idx);
+  node = NodeItem(_items.last().id(), _items.last().peer());
+  return true;
+}
+
+bool
+Bucket::touch(const Identifier &id, const PeerItem &peer) {
+  int idx = find(id);
+  // Candidates get confirmed by a ping only
+  if ((0 > idx) || (! _items[idx].isValid()) || (_items[idx].peer() != peer)) {
+    return false;
+  }
+  _items[idx].touch();
+  return true;
+}
+
+bool
+Bucket::addRttSample(const Identifier &id, int ms) {
+  int idx = find(id);
+  if (0 <= idx) {
+    _items[idx].addRttSample(ms);
+    return true;
+  }
+  // Measure replacements too, they may take the place of slower nodes
+  for (int i=0; i<_replacements.size(); i++) {
+    if (_replacements[i].id() == id) {
+      _replacements[i].addRttSample(ms);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool
+Bucket::preferNearby(const Identifier &id) {
+  if (! full()) { return false; }
+  int idx = -1;
+  for (int i=0; i<_replacements.size(); i++) {
+    if (_replacements[i].id() == id) { idx = i; break; }
+  }
+  if ((0 > idx) || (! _replacements[idx].isValid()) || (! _replacements[idx].hasRtt())) {
+    return false;
   }
+  // Find the slowest confirmed node
+  int slowest = -1;
+  for (int i=0; i<_items.size(); i++) {
+    if ((! _items[i].isValid()) || (! _items[i].hasRtt())) { continue; }
+    if ((0 > slowest) || (_items[i].rtt() > _items[slowest].rtt())) { slowest = i; }
+  }
+  if ((0 > slowest) ||
+      ((BUCKET_PROXIMITY_RATIO*_replacements[idx].rtt()) >= _items[slowest].rtt())) {
+    return false;
+  }
+  logDebug() << "Replace node " << _items[slowest].id() << " (" << _items[slowest].rtt()
+             << "ms) by nearby node " << id << " (" << _replacements[idx].rtt() << "ms).";
+  // Keep the slower node as the most recent replacement
+  Item slower = _items[slowest];
+  _items[slowest] = _replacements[idx];
+  _replacements.remove(idx);
+  _replacements.append(slower);
+  return true;
+}
+
+bool
+Bucket::rtt(const Identifier &id, int &srtt, int &rttvar) const {
+  int idx = find(id);
+  if ((0 > idx) || (! _items[idx].hasRtt())) { return false; }
+  srtt = _items[idx].rtt(); rttvar = _items[idx].rttVar();
+  return true;
+}
+
+bool
+Bucket::setRtt(const Identifier &id, int srtt, int rttvar) {
+  int idx = find(id);
+  if (0 > idx) { return false; }
+  _items[idx].setRtt(srtt, rttvar);
+  return true;
+}
+
+size_t
+Bucket::prefix() const {
+  return _prefix;
 }
 
 void
-Bucket::getNearest(const Identifier &id, QList<NodeItem> &best) const {
-  QHash<Identifier, Item>::const_iterator item = _triples.begin();
-  for (; item != _triples.end(); item++) {
+Bucket::getNearest(NearestNodes &nearest) const {
+  QVector<Item>::const_iterator item = _items.begin();
+  for (; item != _items.end(); item++) {
     // Do not propergate hearsay! (exclude candidates from the list)
-    if (!item->lastSeen().isValid()) { continue; }
-    // Perform an "insort" into best list
-    Distance d = id - item.key();
-    QList<NodeItem>::iterator node = best.begin();
-    while ((node != best.end()) && (d>=(id-node->id()))) { node++; }
-    best.insert(node, NodeItem(item.key(), item->addr(), item->port()));
-    while (best.size() > OVL_K) { best.pop_back(); }
+    if (!item->isValid()) { continue; }
+    nearest.add(item->id(), item->peer());
   }
 }
 
 void
 Bucket::getOlderThan(size_t age, QList<NodeItem> &nodes) const {
-  QHash<Identifier, Item>::const_iterator item = _triples.begin();
-  for (; item != _triples.end(); item++) {
+  QVector<Item>::const_iterator item = _items.begin();
+  for (; item != _items.end(); item++) {
     if (item->olderThan(age)) {
-      nodes.append(NodeItem(item.key(), item->addr(), item->port()));
+      nodes.append(NodeItem(item->id(), item->peer()));
     }
   }
 }
 
-void
+size_t
 Bucket::removeOlderThan(size_t age) {
-  QHash<Identifier, Item>::iterator item = _triples.begin();
-  while (item != _triples.end()) {
+  size_t removed = 0;
+  QVector<Item>::iterator item = _items.begin();
+  while (item != _items.end()) {
     if (item->olderThan(age)) {
-      if (item->lastSeen().isValid()) {
-        logDebug() << "Lost contact to " << item.key()
+      if (item->isValid()) {
+        logDebug() << "Lost contact to " << item->id()
                    << " @ " << item->addr() << ":" << item->port();
       }
-      item = _triples.erase(item);
+      item = _items.erase(item);
+      removed++;
     } else {
       item++;
     }
   }
+  // Drop outdated replacements
+  item = _replacements.begin();
+  while (item != _replacements.end()) {
+    if (item->isValid() && item->olderThan(age)) {
+      item = _replacements.erase(item);
+    } else {
+      item++;
+    }
+  }
+  // Fill free slots with replacements
+  NodeItem node;
+  while (promoteReplacement(node)) {
+    // pass...
+  }
+  return removed;
 }
 
 void
 Bucket::removeNode(const Identifier &id) {
-  _triples.remove(id);
+  int idx = find(id);
+  if (0 <= idx) { _items.remove(idx); }
+}
+
+bool
+Bucket::evict(const Identifier &id, size_t age, NodeItem &replacement) {
+  int idx = find(id);
+  if ((0 > idx) || (! _items[idx].olderThan(age))) {
+    return false;
+  }
+  // Keep the silent node unless there is a replacement not in the bucket yet
+  pruneReplacements();
+  if (_replacements.isEmpty()) {
+    return false;
+  }
+  logDebug() << "Replace silent node " << id << " @ " << _items[idx].addr() << ":"
+             << _items[idx].port();
+  _items.remove(idx);
+  return promoteReplacement(replacement);
 }
 
 
@@ -492,9 +780,12 @@ Bucket::removeNode(const Identifier &id) {
  * Implementation of Buckets
  * ******************************************************************************************** */
 Buckets::Buckets(const Identifier &self)
-  : _self(self), _buckets()
+  : _self(self), _buckets(), _version(0)
 {
   _buckets.reserve(8*OVL_HASH_SIZE);
+  for (size_t i=0; i<(8*OVL_HASH_SIZE); i++) {
+    _buckets.append(Bucket(_self, i));
+  }
 }
 
 const Identifier &
@@ -504,142 +795,178 @@ Buckets::id() const {
 
 bool
 Buckets::empty() const {
-  return 0 == _buckets.size();
+  return 0 == numNodes();
 }
 
 size_t
 Buckets::numNodes() const {
   size_t count = 0;
-  QList<Bucket>::const_iterator item = _buckets.begin();
+  QVector<Bucket>::const_iterator item = _buckets.begin();
   for (; item != _buckets.end(); item++) {
     count += item->numNodes();
   }
   return count;
 }
 
+size_t
+Buckets::numBuckets() const {
+  size_t count = 0;
+  QVector<Bucket>::const_iterator item = _buckets.begin();
+  for (; item != _buckets.end(); item++) {
+    if (item->numNodes()) { count++; }
+  }
+  return count;
+}
+
 void
 Buckets::nodes(QList<NodeItem> &lst) const {
-  QList<Bucket>::const_iterator bucket = _buckets.begin();
+  QVector<Bucket>::const_iterator bucket = _buckets.begin();
   for (; bucket != _buckets.end(); bucket++) {
     bucket->nodes(lst);
   }
 }
 
-bool
-Buckets::contains(const Identifier &id) const {
-  QList<Bucket>::const_iterator bucket = _buckets.begin();
+void
+Buckets::items(QList<Bucket::Item> &lst) const {
+  QVector<Bucket>::const_iterator bucket = _buckets.begin();
   for (; bucket != _buckets.end(); bucket++) {
-    if (bucket->contains(id)) { return true; }
+    bucket->items(lst);
   }
-  return false;
+}
+
+bool
+Buckets::contains(const Identifier &id) const {
+  size_t idx = index(id);
+  if (idx >= size_t(_buckets.size())) { return false; }
+  return _buckets[idx].contains(id);
 }
 
 bool
 Buckets::isValid(const Identifier &id) const {
-  QList<Bucket>::const_iterator bucket = _buckets.begin();
-  for (; bucket != _buckets.end(); bucket++) {
-    if (bucket->contains(id)) {
-      return bucket->isValid(id);
-    }
-  }
-  return false;
+  size_t idx = index(id);
+  if (idx >= size_t(_buckets.size())) { return false; }
+  return _buckets[idx].isValid(id);
 }
 
 NodeItem
 Buckets::getNode(const Identifier &id) const {
-  QList<Bucket>::const_iterator bucket = _buckets.begin();
-  for (; bucket != _buckets.end(); bucket++) {
-    if (bucket->contains(id)) { return bucket->getNode(id); }
-  }
-  return NodeItem();
+  size_t idx = index(id);
+  if (idx >= size_t(_buckets.size())) { return NodeItem(); }
+  return _buckets[idx].getNode(id);
 }
 
 bool
-Buckets::add(const Identifier &id, const QHostAddress &addr, uint16_t port) {
+Buckets::add(const NodeItem &node) {
   // Do not add myself
-  if (id == _self) { return false; }
-
-  // If there are no buckets -> create one.
-  if (empty()) {
-    _buckets.append(Bucket(_self));
-    return _buckets.back().add(id, addr, port);
+  size_t idx = index(node.id());
+  if (idx >= size_t(_buckets.size())) { return false; }
+  Bucket &bucket = _buckets[idx];
+  bool known = bucket.contains(node.id());
+  bool valid = known && bucket.isValid(node.id());
+  PeerItem peer = known ? bucket.getNode(node.id()).peer() : PeerItem();
+  bool added = bucket.add(node);
+  // A new or previously unconfirmed node or a new address changes the nearest nodes
+  if (added || (known && ((! valid) || (peer != node.peer())))) {
+    _version++;
   }
+  return added;
+}
 
-  // Find the bucket, the item belongs to
-  QList<Bucket>::iterator bucket = index(id);
+bool
+Buckets::add(const Identifier &id, const QHostAddress &addr, uint16_t port) {
+  return add(NodeItem(id, addr, port));
+}
 
-  if (bucket->contains(id) || (! bucket->full())) {
-    // If the bucket contains the item already or the bucket is not full
-    //  -> update
-    return bucket->add(id, addr, port);
-  } else {
-    // If the item is new to the bucket and if the bucket is full
-    //  -> check if it can be splitted
-    QList<Bucket>::iterator next = bucket; next++;
-    if (next==_buckets.end()) {
-      Bucket newBucket(_self);
-      bucket->split(newBucket);
-      _buckets.insert(next, newBucket);
-      size_t prefix = (id-_self).leadingBit();
-      if (next->prefix() == prefix) {
-        return next->add(id, addr, port); }
-      else {
-        return this->add(id, addr, port);
-      }
-    }
-  }
-  return false;
+void
+Buckets::addCandidate(const NodeItem &node) {
+  // Do not add myself
+  size_t idx = index(node.id());
+  if (idx >= size_t(_buckets.size())) { return; }
+  _buckets[idx].addCandidate(node);
 }
 
 void
 Buckets::addCandidate(const Identifier &id, const QHostAddress &addr, uint16_t port) {
-  // Do not add myself
-  if (id == _self) { return; }
+  addCandidate(NodeItem(id, addr, port));
+}
 
-  // If there are no buckets -> create one.
-  if (empty()) {
-    _buckets.append(Bucket(_self));
-    _buckets.back().addCandidate(id, addr, port);
-    return;
+bool
+Buckets::touch(const Identifier &id, const PeerItem &peer) {
+  size_t idx = index(id);
+  if (idx >= size_t(_buckets.size())) { return false; }
+  return _buckets[idx].touch(id, peer);
+}
+
+bool
+Buckets::addRttSample(const Identifier &id, int ms) {
+  size_t idx = index(id);
+  if (idx >= size_t(_buckets.size())) { return false; }
+  if (! _buckets[idx].addRttSample(id, ms)) { return false; }
+  // Prefer nearby nodes among the confirmed ones
+  if (_buckets[idx].preferNearby(id)) {
+    _version++;
   }
+  return true;
+}
 
-  // Find the bucket, the item belongs to
-  QList<Bucket>::iterator bucket = index(id);
-  // If node is known -> done
-  if (bucket->contains(id)) { return; }
+bool
+Buckets::rtt(const Identifier &id, int &srtt, int &rttvar) const {
+  size_t idx = index(id);
+  if (idx >= size_t(_buckets.size())) { return false; }
+  return _buckets[idx].rtt(id, srtt, rttvar);
+}
 
-  if (! bucket->full()) {
-    // If the bucket is not full -> add
-    bucket->addCandidate(id, addr, port);
-  } else {
-    // If the item is new to the bucket and if the bucket is full
-    //  -> check if it can be splitted
-    QList<Bucket>::iterator next = bucket; next++;
-    if (next==_buckets.end()) {
-      Bucket newBucket(_self);
-      bucket->split(newBucket);
-      _buckets.insert(next, newBucket);
-      size_t prefix = (id-_self).leadingBit();
-      if (next->prefix() == prefix) {
-        next->addCandidate(id, addr, port);
-      } else {
-        addCandidate(id, addr, port);
-      }
-    }
+bool
+Buckets::setRtt(const Identifier &id, int srtt, int rttvar) {
+  size_t idx = index(id);
+  if (idx >= size_t(_buckets.size())) { return false; }
+  return _buckets[idx].setRtt(id, srtt, rttvar);
+}
+
+void
+Buckets::getUnderpopulated(QList<size_t> &indices) const {
+  // Find nearest non-empty bucket, the buckets beyond are expected to be empty
+  int nearest = _buckets.size()-1;
+  while ((0 <= nearest) && (0 == _buckets[nearest].numNodes())) { nearest--; }
+  for (int i=0; i<=nearest; i++) {
+    if (! _buckets[i].full()) { indices.append(i); }
   }
 }
 
+Identifier
+Buckets::randomId(size_t index) const {
+  if (index >= (8*OVL_HASH_SIZE)) { return _self; }
+  // Keep the bits of my identifier before index, flip the bit at index and randomize the
+  // remaining bits
+  Identifier random = Identifier::create();
+  char id[OVL_HASH_SIZE];
+  size_t byte = index/8; uint8_t mask = 0x80 >> (index%8);
+  memcpy(id, _self.constData(), byte);
+  memcpy(id+byte+1, random.constData()+byte+1, OVL_HASH_SIZE-byte-1);
+  uint8_t before = ~((mask<<1)-1), after = mask-1;
+  id[byte] = (_self.constData()[byte] & before) | (~_self.constData()[byte] & mask) |
+      (random.constData()[byte] & after);
+  return Identifier(id);
+}
+
 void
 Buckets::getNearest(const Identifier &id, QList<NodeItem> &best) const {
-  QList<Bucket>::const_iterator bucket = _buckets.begin();
+  NearestNodes nearest(id);
+  // Merge with the given nodes
+  foreach (const NodeItem &node, best) {
+    nearest.add(node);
+  }
+  QVector<Bucket>::const_iterator bucket = _buckets.begin();
   for (; bucket != _buckets.end(); bucket++) {
-    bucket->getNearest(id, best);
+    bucket->getNearest(nearest);
   }
+  best.clear();
+  nearest.nodes(best);
 }
 
 void
 Buckets::getOlderThan(size_t seconds, QList<NodeItem> &nodes) const {
-  QList<Bucket>::const_iterator bucket = _buckets.begin();
+  QVector<Bucket>::const_iterator bucket = _buckets.begin();
   for (; bucket != _buckets.end(); bucket++) {
     bucket->getOlderThan(seconds, nodes);
   }
@@ -647,22 +974,17 @@ Buckets::getOlderThan(size_t seconds, QList<NodeItem> &nodes) const {
 
 void
 Buckets::removeOlderThan(size_t seconds) {
-  QList<Bucket>::iterator bucket = _buckets.begin();
+  QVector<Bucket>::iterator bucket = _buckets.begin();
   for (; bucket != _buckets.end(); bucket++) {
-    bucket->removeOlderThan(seconds);
+    if (bucket->removeOlderThan(seconds)) { _version++; }
   }
 }
 
-QList<Bucket>::iterator
-Buckets::index(const Identifier &id) {
-  size_t prefix = (id-_self).leadingBit();
-  if (2 > _buckets.size()) { return _buckets.begin(); }
-  QList<Bucket>::iterator current = _buckets.begin();
-  QList<Bucket>::iterator next = _buckets.begin(); next++;
-  for (; next < _buckets.end(); current++, next++) {
-    if (current->prefix() == prefix) { return current; }
-    if (next->prefix() > prefix) { return current; }
-  }
-  return _buckets.end()--;
+bool
+Buckets::evict(const Identifier &id, size_t seconds, NodeItem &replacement) {
+  size_t idx = index(id);
+  if (idx >= size_t(_buckets.size())) { return false; }
+  if (! _buckets[idx].evict(id, seconds, replacement)) { return false; }
+  _version++;
+  return true;
 }
-
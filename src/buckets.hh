@@ -3,59 +3,107 @@
 
 #include "dht_config.hh"
 #include "logger.hh"
+#include "utils.hh"
 
 #include <QByteArray>
 #include <QList>
+#include <QVector>
 #include <QHash>
 #include <QHostAddress>
-#include <QDateTime>
 
 #include <inttypes.h>
+#include <string.h>
+#include <netinet/in.h>
 
 // Forward declaration
 class Identifier;
 
 /** The distance between two identifiers.
+ * The distance is held as 32-bit words in host byte order, the first word holds the most
+ * significant bits. Hence distances can be compared word-wise.
  * @ingroup core */
-class Distance : public QByteArray
+class Distance
 {
 public:
+  /** Empty constructor, the maximum distance. */
+  Distance();
   /** Computes the distance between the identifiers @c a and @c b. */
   Distance(const Identifier &a, const Identifier &b);
-  /** Copy constructor. */
-  Distance(const Distance &distance);
+
   /** Returns the bit at index @c idx of the distance. Bit 0 is the MSB. */
-  bool bit(size_t idx) const;
+  inline bool bit(size_t idx) const {
+    return (_words[idx/32] >> (31-(idx%32))) & 1;
+  }
   /** Returns the index of the leading non-zero bit of the distance.*/
   size_t leadingBit() const;
+
+  /** Compares two distances. */
+  inline bool operator<(const Distance &other) const {
+    for (size_t i=0; i<OVL_HASH_WORDS; i++) {
+      if (_words[i] != other._words[i]) { return _words[i] < other._words[i]; }
+    }
+    return false;
+  }
+  /** Compares two distances. */
+  inline bool operator>=(const Distance &other) const { return !(*this < other); }
+  /** Compares two distances. */
+  inline bool operator>(const Distance &other) const { return other < *this; }
+  /** Compares two distances. */
+  inline bool operator<=(const Distance &other) const { return !(other < *this); }
+  /** Compares two distances. */
+  inline bool operator==(const Distance &other) const {
+    return 0 == memcmp(_words, other._words, sizeof(_words));
+  }
+
+protected:
+  /** The distance words, MSB first. */
+  uint32_t _words[OVL_HASH_WORDS];
 };
 
+Q_DECLARE_TYPEINFO(Distance, Q_MOVABLE_TYPE);
 
 /** Represents an identifier in the DHT.
+ * An identifier is a fixed-size value type, it holds the @c OVL_HASH_SIZE bytes inline. A
+ * default constructed identifier is invalid.
  * @ingroup core */
-class Identifier : public QByteArray
+class Identifier
 {
 public:
-  /** Creates an empty identifier. */
+  /** Creates an invalid identifier. */
   Identifier();
-  /** Constructor. */
+  /** Constructor, copies @c OVL_HASH_SIZE bytes from @c id. */
   explicit Identifier(const char *id);
-  /** Constructor. */
+  /** Constructor, the identifier is invalid if @c id is not of size @c OVL_HASH_SIZE. */
   Identifier(const QByteArray &id);
-  /** Copy constructor. */
-  Identifier(const Identifier &other);
 
-  /** Assignment. */
-  Identifier &operator=(const Identifier &other);
   /** Comparison. */
-  bool operator==(const Identifier &other) const;
+  inline bool operator==(const Identifier &other) const {
+    return (_valid == other._valid) &&
+        (0 == memcmp(_data.words, other._data.words, OVL_HASH_SIZE));
+  }
+  /** Comparison. */
+  inline bool operator!=(const Identifier &other) const {
+    return !(*this == other);
+  }
   /** Computes the distance. */
-  Distance operator-(const Identifier &other) const;
+  inline Distance operator-(const Identifier &other) const {
+    return Distance(*this, other);
+  }
 
-  /** Returns @c true if the identifier is empty. */
+  /** Returns @c true if the identifier is the hash of an empty string. */
   bool isNull() const;
   /** Returns @c true if the identifier is a valid DHT ID. */
-  bool isValid() const;
+  inline bool isValid() const { return _valid; }
+  /** Returns the size of the identifier in bytes, 0 if invalid. */
+  inline int size() const { return _valid ? OVL_HASH_SIZE : 0; }
+  /** Returns a pointer to the identifier bytes. */
+  inline const char *constData() const { return (const char *)_data.bytes; }
+  /** Returns a pointer to the identifier bytes. */
+  inline const char *data() const { return (const char *)_data.bytes; }
+  /** Returns the i-th word of the identifier in memory (network) byte order. */
+  inline uint32_t word(size_t i) const { return _data.words[i]; }
+  /** Returns the identifier as a byte array. */
+  QByteArray toByteArray() const;
 
   /** Returns the base-32 (RFC4648) representation of the key. */
   QString toBase32() const;
@@ -67,8 +115,31 @@ public:
   static Identifier fromBase32(const QString &base32);
   /** Constructs an identifier as the hash of an empty string. */
   static Identifier null();
+  /** Returns the identifier of the given network or service name, the hash of its UTF-8
+   * representation. */
+  static Identifier fromName(const QString &name);
+
+protected:
+  /** The identifier bytes, word-aligned. */
+  union {
+    /** Bytes of the identifier. */
+    uint8_t  bytes[OVL_HASH_SIZE];
+    /** Words of the identifier, in memory (network) byte order. */
+    uint32_t words[OVL_HASH_WORDS];
+  } _data;
+  /** If @c true, the identifier holds a valid ID. */
+  bool _valid;
 };
 
+// Identifiers can be moved in memory
+Q_DECLARE_TYPEINFO(Identifier, Q_MOVABLE_TYPE);
+
+// Hash function for the Identifier class. Identifiers are received from the network and may be
+// chosen to collide, hence all bytes are hashed with the (random) seed of the hash table.
+inline uint qHash(const Identifier &key, uint seed=0) {
+  return qHashBits(key.constData(), OVL_HASH_SIZE, seed);
+}
+
 /** Logger output operation for identifier. */
 inline QTextStream &operator<<(QTextStream &stream, const Identifier &id) {
   stream << id.toBase32();
@@ -77,6 +148,10 @@ inline QTextStream &operator<<(QTextStream &stream, const Identifier &id) {
 
 
 /** Represents a peer (IP address + port) in the network.
+ * A peer is a fixed-size value type. The address is held inline as a 16-byte IPv6 address in
+ * network byte order, IPv4 addresses are mapped into the IPv6 space. Hence peers convert
+ * cheaply from and to socket addresses and into the DHT triples, a @c QHostAddress is only
+ * constructed on demand by @c addr.
  * @ingroup core */
 class PeerItem
 {
@@ -85,35 +160,47 @@ public:
   PeerItem();
   /** Constructor from address and port. */
   PeerItem(const QHostAddress &addr, uint16_t port);
-  /** Copy constructor. */
-  PeerItem(const PeerItem &other);
-  /** Assignment operator. */
-  PeerItem &operator=(const PeerItem &other);
+  /** Constructor from a 16-byte IPv6 or IPv4-mapped address in network byte order and port. */
+  PeerItem(const uint8_t *ip, uint16_t port);
+  /** Constructor from a socket address. */
+  explicit PeerItem(const sockaddr_in6 &addr);
 
   /** Compares two @c PeerItem. */
   inline bool operator==(const PeerItem &other) const {
-    if (_addr != other._addr) { return false; }
-    return _port == other._port;
+    return (_port == other._port) && (0 == memcmp(_ip, other._ip, 16));
+  }
+  /** Compares two @c PeerItem. */
+  inline bool operator!=(const PeerItem &other) const {
+    return !(*this == other);
   }
 
-  /** Returns the address of the peer. */
-  const QHostAddress &addr() const;
+  /** Returns the address of the peer. IPv4-mapped addresses are returned as IPv4 addresses. */
+  QHostAddress addr() const;
   /** Returns the port of the peer. */
-  uint16_t port() const;
+  inline uint16_t port() const { return _port; }
+  /** Returns the 16-byte IPv6 or IPv4-mapped address of the peer in network byte order. */
+  inline const uint8_t *ip() const { return _ip; }
+  /** Returns @c true if the address is an IPv4-mapped address. */
+  bool isIPv4() const;
+  /** Stores the address and port of the peer in the given socket address. */
+  void toSockAddr(sockaddr_in6 &addr) const;
 
 protected:
-  /** The address of the peer. */
-  QHostAddress _addr;
+  /** The IPv6 or IPv4-mapped address of the peer in network byte order. */
+  uint8_t  _ip[16];
   /** The port of the peer. */
-  uint16_t     _port;
+  uint16_t _port;
 };
 
+Q_DECLARE_TYPEINFO(PeerItem, Q_MOVABLE_TYPE);
+
 // Hash function for the PeerItem class
 inline uint qHash(const PeerItem &key, uint seed) {
-  return qHash(key.addr(), seed) ^ qHash(key.port());
+  return qHashBits(key.ip(), 16, seed) ^ key.port();
 }
 
 /** Represents a node (ID + IP address + port, or ID + Peer) in the network.
+ * Like @c PeerItem and @c Identifier, a node is a fixed-size value type.
  * @ingroup core */
 class NodeItem: public PeerItem
 {
@@ -124,19 +211,19 @@ public:
   NodeItem(const Identifier &id, const QHostAddress &addr, uint16_t port);
   /** Constructor from ID and peer. */
   NodeItem(const Identifier &id, const PeerItem &peer);
-  /** Copy constructor. */
-  NodeItem(const NodeItem &other);
-  /** Assignment operator. */
-  NodeItem &operator=(const NodeItem &other);
 
   /** Returns the identifier of the node. */
-  const Identifier &id() const;
+  inline const Identifier &id() const { return _id; }
+  /** Returns the peer (address and port) of the node. */
+  inline const PeerItem &peer() const { return *this; }
 
 protected:
   /** The identifier of the node. */
   Identifier _id;
 };
 
+Q_DECLARE_TYPEINFO(NodeItem, Q_MOVABLE_TYPE);
+
 
 /** Represents an announcement made by another node.
  * @ingroup internal */
@@ -152,20 +239,69 @@ public:
   /** Assignment operator. */
   AnnouncementItem &operator =(const AnnouncementItem &other);
   /** Returns true if the announcement is older than the given amount of seconds. */
-  bool olderThan(size_t seconds) const;
+  inline bool olderThan(size_t seconds) const {
+    return (Ticks::now()-_timestamp) > seconds;
+  }
 
 protected:
-  /** The timestamp of the announcement. */
-  QDateTime _timestamp;
+  /** The time of the announcement in @c Ticks. */
+  uint32_t _timestamp;
 };
 
 // Hash function for the AnnoucementItem class
 inline uint qHash(const AnnouncementItem &key, uint seed) {
-  return qHash(key.addr(), seed) ^ qHash(key.port());
+  return qHash((const PeerItem &)key, seed);
 }
 
 
+/** Selects the nodes nearest to an identifier.
+ * Keeps the @c OVL_K nearest nodes offered in a fixed-capacity max-heap over their precomputed
+ * distances to the target. Hence the distance of every node offered is computed once and no
+ * memory gets allocated during the selection.
+ * @ingroup internal */
+class NearestNodes
+{
+public:
+  /** Constructor.
+   * @param id Specifies the target identifier. */
+  NearestNodes(const Identifier &id);
+
+  /** Returns the target identifier. */
+  const Identifier &id() const;
+  /** Returns the number of nodes selected. */
+  size_t size() const;
+  /** Returns @c true if @c OVL_K nodes are selected. */
+  bool full() const;
+
+  /** Offers a node. Returns @c true if the node was selected. */
+  bool add(const Identifier &id, const PeerItem &peer);
+  /** Offers a node. Returns @c true if the node was selected. */
+  bool add(const NodeItem &node);
+
+  /** Appends the selected nodes to the given list, ordered by their distance to the target. */
+  void nodes(QList<NodeItem> &lst) const;
+
+protected:
+  /** Restores the heap property from the given index downwards. */
+  void siftDown(size_t idx);
+  /** Restores the heap property from the given index upwards. */
+  void siftUp(size_t idx);
+
+protected:
+  /** The target identifier. */
+  Identifier _id;
+  /** The number of nodes selected. */
+  size_t _size;
+  /** The distances of the selected nodes, the largest distance at index 0. */
+  Distance _distances[OVL_MAX_K];
+  /** The selected nodes. */
+  NodeItem _nodes[OVL_MAX_K];
+};
+
+
 /** Represents a single k-bucket.
+ * A bucket holds up to @c OVL_K nodes sharing the same prefix w.r.t. the identifier of this
+ * node, i.e. the index of the leading bit of their distance to this node.
  * @ingroup internal */
 class Bucket
 {
@@ -176,60 +312,97 @@ public:
   public:
     /** Empty constructor. */
     Item();
-    /** Constructor from identifier, address, port and prefix. */
-    Item(const QHostAddress &addr, uint16_t port, size_t prefix, const QDateTime &lastSeen=QDateTime());
+    /** Constructor from identifier, peer and prefix. */
+    Item(const Identifier &id, const PeerItem &peer, size_t prefix, uint32_t lastSeen=0);
     /** Copy constructor. */
     Item(const Item &other);
     /** Assignment operator. */
     Item &operator=(const Item &other);
 
+    /** Returns the identifier of the item. */
+    const Identifier &id() const;
     /** Returns the precomputed @c prefix of the item w.r.t. the ID of the node. */
     size_t prefix() const;
     /** Retruns the address and port as a @c PeerItem. */
     const PeerItem &peer() const;
     /** The address of the item. */
-    const QHostAddress &addr() const;
+    QHostAddress addr() const;
     /** The port of the item. */
     uint16_t port() const;
-    /** The time of the item last seen. */
-    const QDateTime &lastSeen() const;
+    /** The time of the item last seen in @c Ticks, 0 if never seen. */
+    uint32_t lastSeen() const;
+    /** Returns @c true if the item has been seen, i.e. it is not a candidate. */
+    inline bool isValid() const { return 0 != _lastSeen; }
     /** Returns true if the entry is older than the specified seconds. */
     inline bool olderThan(size_t seconds) const {
-      if (! _lastSeen.isValid()) { return true; }
-      return (_lastSeen.addSecs(seconds) < QDateTime::currentDateTime());
+      return (0 == _lastSeen) || ((Ticks::now()-_lastSeen) > seconds);
     }
+    /** Updates address, port and the time the item was last seen. The RTT estimate is kept
+     * unless the address or port changed. */
+    void update(const PeerItem &peer);
+    /** Updates the time the item was last seen. */
+    inline void touch() { _lastSeen = Ticks::now(); }
+
+    /** Returns @c true if there is an RTT estimate for the item. */
+    inline bool hasRtt() const { return 0 <= _srtt; }
+    /** Returns the smoothed round-trip time in ms or -1 if unknown. */
+    inline int rtt() const { return _srtt; }
+    /** Returns the round-trip time variation in ms or -1 if unknown. */
+    inline int rttVar() const { return _rttvar; }
+    /** Updates the RTT estimate with a measured round-trip time in ms (RFC 6298). */
+    void addRttSample(int ms);
+    /** Resets the RTT estimate, e.g. to a previously saved one. */
+    inline void setRtt(int srtt, int rttvar) { _srtt = srtt; _rttvar = rttvar; }
 
   protected:
+    /** The identifier of the item. */
+    Identifier   _id;
     /** The prefix -- index of the leading bit of the difference between this identifier and the
      * identifier of the node. */
     size_t       _prefix;
     /** The address and port of the item. */
     PeerItem     _peer;
-    /** The time, the item was last seen. */
-    QDateTime    _lastSeen;
+    /** The time, the item was last seen in @c Ticks, 0 if never seen. */
+    uint32_t     _lastSeen;
+    /** The smoothed round-trip time in ms, -1 if unknown. */
+    int          _srtt;
+    /** The round-trip time variation in ms, -1 if unknown. */
+    int          _rttvar;
   };
 
 public:
+  /** Empty constructor. */
+  Bucket();
   /** Constructor. */
-  Bucket(const Identifier &self);
+  Bucket(const Identifier &self, size_t prefix);
   /** Copy constructor. */
   Bucket(const Bucket &other);
+  /** Assignment operator. */
+  Bucket &operator=(const Bucket &other);
 
-  /** The the nodes that are closest to the given identifier. */
-  void getNearest(const Identifier &id, QList<NodeItem> &best) const;
+  /** Offers the nodes of the bucket to the given selection of nearest nodes. */
+  void getNearest(NearestNodes &nearest) const;
   /** Get all nodes that are older than the given age. */
   void getOlderThan(size_t age, QList<NodeItem> &nodes) const;
-  /** Removes all nodes that are older than the given age. */
-  void removeOlderThan(size_t age);
+  /** Removes all nodes that are older than the given age and fills the free slots with nodes
+   * from the replacement cache. Returns the number of nodes removed. */
+  size_t removeOlderThan(size_t age);
   /** Removes a single node specified by the given identifier. */
   void removeNode(const Identifier &id);
+  /** Replaces the given node by the most recently seen node of the replacement cache, if the node
+   * is older than the given age and there is a replacement. Returns @c true on success. */
+  bool evict(const Identifier &id, size_t age, NodeItem &replacement);
 
   /** Returns @c true if the bucket is full. */
   bool full() const;
   /** Returns the number of nodes held in the bucket. */
   size_t numNodes() const;
+  /** Returns the number of nodes held in the replacement cache. */
+  size_t numReplacements() const;
   /** Returns the list of all nodes held in the bucket. */
   void nodes(QList<NodeItem> &lst) const;
+  /** Returns all items held in the bucket including candidates. */
+  void items(QList<Item> &lst) const;
   /** Returns @c true if the bucket contains the given identifier. */
   bool contains(const Identifier &id) const;
   /** Returns true if the node has a valid timestamp. */
@@ -237,19 +410,39 @@ public:
   /** Returns the given node. */
   NodeItem getNode(const Identifier &id) const;
   /** Adds or updates an node. */
-  bool add(const Identifier &id, const QHostAddress &addr, uint16_t port);
+  bool add(const NodeItem &node);
   /** Adds a candidate node. */
-  void addCandidate(const Identifier &id, const QHostAddress &addr, uint16_t port);
+  void addCandidate(const NodeItem &node);
+  /** Refreshes the time the given node was last seen, if it is a confirmed node of the bucket
+   * reachable at the given peer. Returns @c false otherwise. */
+  bool touch(const Identifier &id, const PeerItem &peer);
+  /** Adds a measured round-trip time in ms to the RTT estimate of the given node or replacement.
+   * Returns @c false if the node is neither in the bucket nor in the replacement cache. */
+  bool addRttSample(const Identifier &id, int ms);
+  /** Exchanges the slowest confirmed node of the full bucket with the given confirmed replacement,
+   * if the replacement is considerably faster. The slower node is kept as a replacement.
+   * Returns @c true if the nodes were exchanged. */
+  bool preferNearby(const Identifier &id);
+  /** Obtains the RTT estimate of the given node.
+   * Returns @c false if the node is unknown or there is no estimate. */
+  bool rtt(const Identifier &id, int &srtt, int &rttvar) const;
+  /** Resets the RTT estimate of the given node. Returns @c false if the node is unknown. */
+  bool setRtt(const Identifier &id, int srtt, int rttvar);
   /** The prefix of the bucket. */
   size_t prefix() const;
 
-  /** Splits the bucket at its prefix. Means all item with a higher prefix (smaller distance)
-   * than the prefix of this bucket are moved to the new one. */
-  void split(Bucket &newBucket);
-
 protected:
-  /** Adds an item. */
-  bool add(const Identifier &id, const Item &item);
+  /** Returns the index of the given node in the item vector or -1 if not present. */
+  int find(const Identifier &id) const;
+  /** Adds a node to the replacement cache, the oldest entry is dropped if the cache is full.
+   * A confirmed entry is not replaced by a candidate. */
+  void addReplacement(const Item &item);
+  /** Drops the nodes of the replacement cache, that entered the bucket meanwhile. */
+  void pruneReplacements();
+  /** Moves a node from the replacement cache into the bucket. Confirmed nodes are preferred over
+   * candidates, among them the one with the lowest RTT, otherwise the most recently seen one.
+   * Returns @c false if the cache is empty. */
+  bool promoteReplacement(NodeItem &node);
 
 protected:
   /** Myself. */
@@ -258,12 +451,17 @@ protected:
   size_t _maxSize;
   /** The prefix of the bucket. */
   size_t _prefix;
-  /** Item table. */
-  QHash<Identifier, Item> _triples;
+  /** The items of the bucket, at most @c _maxSize. */
+  QVector<Item> _items;
+  /** Nodes that did not fit into the full bucket, at most @c _maxSize, most recent last. */
+  QVector<Item> _replacements;
 };
 
 
-/** A ordered list of buckets.
+/** The routing table, a fixed array of k-buckets, one for each possible prefix.
+ * The bucket of a node is given by the index of the leading bit of its distance to this node,
+ * hence the bucket of any identifier is determined in constant time. As every bucket holds at
+ * most @c OVL_K nodes, no additional index is needed to locate a node.
  * @ingroup internal */
 class Buckets
 {
@@ -273,7 +471,7 @@ public:
 
   /** Returns the node id. */
   const Identifier &id() const;
-  /** Returns @c true if the bucket list is empty. */
+  /** Returns @c true if the buckets hold no nodes. */
   bool empty() const;
   /** Returns true if the buckets contain the given node. */
   bool contains(const Identifier &id) const;
@@ -283,30 +481,71 @@ public:
   NodeItem getNode(const Identifier &id) const;
   /** Returns the number of nodes in the buckets. */
   size_t numNodes() const;
+  /** Returns the number of non-empty buckets. */
+  size_t numBuckets() const;
   /** Returns the list of all nodes in the buckets. */
   void nodes(QList<NodeItem> &lst) const;
+  /** Returns all items of all buckets including candidates. */
+  void items(QList<Bucket::Item> &lst) const;
   /** Collects the nearest known nodes. */
   void getNearest(const Identifier &id, QList<NodeItem> &best) const;
+  /** Collects the indices of all buckets that are not full, up to the nearest non-empty bucket.
+   * Lookups of random identifiers within these buckets (see @c randomId) fill them. */
+  void getUnderpopulated(QList<size_t> &indices) const;
+  /** Returns a random identifier that falls into the bucket with the given index. */
+  Identifier randomId(size_t index) const;
 
+  /** Adds or updates a node. */
+  bool add(const NodeItem &node);
   /** Adds or updates a node. */
   bool add(const Identifier &id, const QHostAddress &addr, uint16_t port);
   /** Adds a candidate node. */
+  void addCandidate(const NodeItem &node);
+  /** Adds a candidate node. */
   void addCandidate(const Identifier &id, const QHostAddress &addr, uint16_t port);
+  /** Refreshes the time the given node was last seen, if it is a confirmed node reachable at the
+   * given peer. Any authenticated traffic from a node serves as a proof of liveness, hence the
+   * node needs no refresh ping. Returns @c false if the node is unknown. */
+  bool touch(const Identifier &id, const PeerItem &peer);
+  /** Adds a measured round-trip time in ms to the RTT estimate of the given node. A considerably
+   * faster replacement takes the place of the slowest node of its bucket (proximity neighbour
+   * selection). Returns @c false if the node is unknown. */
+  bool addRttSample(const Identifier &id, int ms);
+  /** Obtains the smoothed round-trip time and its variation in ms of the given node.
+   * Returns @c false if the node is unknown or there is no estimate. */
+  bool rtt(const Identifier &id, int &srtt, int &rttvar) const;
+  /** Resets the RTT estimate of the given node, e.g. to a previously saved one.
+   * Returns @c false if the node is unknown. */
+  bool setRtt(const Identifier &id, int srtt, int rttvar);
 
   /** Collects all nodes that are "older" than the specified age (in seconds). */
   void getOlderThan(size_t seconds, QList<NodeItem> &nodes) const;
-  /** Removes all nodes that are "older" than the specified age (in seconds). */
+  /** Removes all nodes that are "older" than the specified age (in seconds). Free slots are
+   * filled from the replacement caches of the buckets. */
   void removeOlderThan(size_t seconds);
+  /** Replaces the given node by a node from the replacement cache of its bucket, if the node is
+   * "older" than the specified age (in seconds), e.g. as it did not answer a ping. On success,
+   * @c replacement holds the promoted node and @c true is returned. */
+  bool evict(const Identifier &id, size_t seconds, NodeItem &replacement);
+
+  /** Returns the version of the routing table. It changes whenever the set of nodes returned by
+   * @c getNearest may have changed, i.e. if a node was added, removed or moved to another address. */
+  inline quint64 version() const { return _version; }
 
 protected:
-  /** Returns the bucket index, an item should be searched for. */
-  QList<Bucket>::iterator index(const Identifier &id);
+  /** Returns the bucket index, an item should be searched for. This is the index of the leading
+   * bit of the distance to this node, @c 8*OVL_HASH_SIZE for the identifier of this node. */
+  inline size_t index(const Identifier &id) const {
+    return (id-_self).leadingBit();
+  }
 
 protected:
   /** My identifier. */
   Identifier _self;
-  /** The bucket list. */
-  QList<Bucket> _buckets;
+  /** The buckets, indexed by prefix. */
+  QVector<Bucket> _buckets;
+  /** The version of the routing table. */
+  quint64 _version;
 };
 
 
@@ -0,0 +1,109 @@
+#include "cookietable.hh"
+
+#include <openssl/rand.h>
+
+
+/* ******************************************************************************************** *
+ * Implementation of CookieTable
+ * ******************************************************************************************** */
+CookieTable::CookieTable(size_t capacity)
+  : _seed(0), _capacity(8), _streams(0), _requests(0), _entries(0)
+{
+  RAND_bytes((unsigned char *)&_seed, sizeof(_seed));
+  while (_capacity < capacity) { _capacity *= 2; }
+  _entries = new Entry[_capacity];
+  memset(_entries, 0, _capacity*sizeof(Entry));
+}
+
+CookieTable::~CookieTable() {
+  delete[] _entries;
+}
+
+size_t
+CookieTable::probe(const char *cookie) const {
+  size_t idx = slot(cookie);
+  while ((EMPTY != _entries[idx].type) &&
+         (0 != memcmp(_entries[idx].cookie, cookie, OVL_COOKIE_SIZE))) {
+    idx = (idx+1) & (_capacity-1);
+  }
+  return idx;
+}
+
+const CookieTable::Entry *
+CookieTable::find(const char *cookie) const {
+  size_t idx = probe(cookie);
+  if (EMPTY == _entries[idx].type) { return 0; }
+  return _entries+idx;
+}
+
+bool
+CookieTable::insert(const char *cookie, SecureSocket *stream) {
+  return insert(cookie, STREAM, stream);
+}
+
+bool
+CookieTable::insert(const char *cookie, Request *request) {
+  return insert(cookie, REQUEST, request);
+}
+
+bool
+CookieTable::insert(const char *cookie, Type type, void *item) {
+  // Keep the load factor below 1/2
+  if (2*(_streams+_requests+1) > _capacity) { grow(); }
+  Entry &entry = _entries[probe(cookie)];
+  // Never replace an entry of the other type
+  if ((EMPTY != entry.type) && (type != entry.type)) { return false; }
+  if (STREAM == entry.type) { _streams--; }
+  else if (REQUEST == entry.type) { _requests--; }
+  memcpy(entry.cookie, cookie, OVL_COOKIE_SIZE);
+  entry.type = type;
+  entry.item = item;
+  if (STREAM == type) { _streams++; }
+  else { _requests++; }
+  return true;
+}
+
+bool
+CookieTable::remove(const char *cookie, Type type) {
+  size_t idx = probe(cookie);
+  if ((EMPTY == _entries[idx].type) || (type != _entries[idx].type)) { return false; }
+  if (STREAM == type) { _streams--; }
+  else { _requests--; }
+
+  // Shift back the following entries of the cluster that may not be found otherwise
+  size_t next = idx;
+  while (true) {
+    next = (next+1) & (_capacity-1);
+    if (EMPTY == _entries[next].type) { break; }
+    size_t home = slot(_entries[next].cookie);
+    // Move entry if its home slot is not within (idx, next]
+    if (((next-home) & (_capacity-1)) >= ((next-idx) & (_capacity-1))) {
+      _entries[idx] = _entries[next];
+      idx = next;
+    }
+  }
+  _entries[idx].type = EMPTY;
+  _entries[idx].item = 0;
+  return true;
+}
+
+size_t
+CookieTable::count(Type type) const {
+  if (STREAM == type) { return _streams; }
+  if (REQUEST == type) { return _requests; }
+  return _capacity-_streams-_requests;
+}
+
+void
+CookieTable::grow() {
+  Entry *old = _entries;
+  size_t oldCapacity = _capacity;
+  _capacity *= 2;
+  _entries = new Entry[_capacity];
+  memset(_entries, 0, _capacity*sizeof(Entry));
+  for (size_t i=0; i<oldCapacity; i++) {
+    if (EMPTY == old[i].type) { continue; }
+    _entries[probe(old[i].cookie)] = old[i];
+  }
+  delete[] old;
+}
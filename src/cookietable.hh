@@ -0,0 +1,103 @@
+#ifndef __OVL_COOKIETABLE_HH__
+#define __OVL_COOKIETABLE_HH__
+
+#include "dht_config.hh"
+
+#include <QHash>
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+// Forward declarations
+class SecureSocket;
+class Request;
+
+
+/** Maps the cookies of received datagrams to open streams and pending requests.
+ *
+ * A flat open-addressing hash table with linear probing, keyed by the raw @c OVL_COOKIE_SIZE
+ * bytes of the cookie. Each entry is tagged as a stream or a request, hence a received datagram
+ * is dispatched with a single probe sequence. The cookies of streams are chosen by the peer, hence
+ * all bytes of the cookie are hashed with a random seed of the table. Removed entries are closed
+ * by shifting back their successors, so the table needs no tombstones.
+ * @ingroup internal */
+class CookieTable
+{
+public:
+  /** The type of an entry. */
+  typedef enum {
+    EMPTY = 0, ///< An unused slot.
+    STREAM,    ///< An open stream.
+    REQUEST    ///< A pending request.
+  } Type;
+
+  /** An entry of the table. */
+  struct Entry {
+    /** The cookie. */
+    char cookie[OVL_COOKIE_SIZE];
+    /** The type of the entry. */
+    Type type;
+    /** The stream or request. */
+    void *item;
+
+    /** Returns the stream of a @c STREAM entry. */
+    inline SecureSocket *stream() const { return (SecureSocket *)item; }
+    /** Returns the request of a @c REQUEST entry. */
+    inline Request *request() const { return (Request *)item; }
+  };
+
+public:
+  /** Constructor.
+   * @param capacity Specifies the initial number of slots, rounded up to a power of 2. */
+  explicit CookieTable(size_t capacity=64);
+  /** Destructor. Does not delete any streams or requests. */
+  ~CookieTable();
+
+  /** Returns the entry for the given cookie or 0 if there is none. */
+  const Entry *find(const char *cookie) const;
+  /** Associates the given cookie with a stream, replaces any previous stream. Returns @c false and
+   * leaves the table unchanged if the cookie is associated with a request. */
+  bool insert(const char *cookie, SecureSocket *stream);
+  /** Associates the given cookie with a request, replaces any previous request. Returns @c false
+   * and leaves the table unchanged if the cookie is associated with a stream. */
+  bool insert(const char *cookie, Request *request);
+  /** Removes the entry for the given cookie if it is of the given type.
+   * Returns @c true if an entry was removed. */
+  bool remove(const char *cookie, Type type);
+
+  /** Returns the number of entries of the given type. */
+  size_t count(Type type) const;
+
+protected:
+  /** Returns the first slot of the probe sequence of the given cookie. */
+  inline size_t slot(const char *cookie) const {
+    return qHashBits(cookie, OVL_COOKIE_SIZE, _seed) & (_capacity-1);
+  }
+  /** Returns the slot holding the given cookie or the empty slot ending its probe sequence. */
+  size_t probe(const char *cookie) const;
+  /** Inserts or replaces an entry of the given type. */
+  bool insert(const char *cookie, Type type, void *item);
+  /** Doubles the number of slots. */
+  void grow();
+
+private:
+  /** Tables cannot be copied. */
+  CookieTable(const CookieTable &other);
+  /** Tables cannot be copied. */
+  CookieTable &operator=(const CookieTable &other);
+
+protected:
+  /** The random hash seed. */
+  uint _seed;
+  /** The number of slots, a power of 2. */
+  size_t _capacity;
+  /** The number of stream entries. */
+  size_t _streams;
+  /** The number of request entries. */
+  size_t _requests;
+  /** The slots. */
+  Entry *_entries;
+};
+
+#endif // __OVL_COOKIETABLE_HH__
@@ -682,18 +682,18 @@ error:
   return -1;
 }
 
-void
+bool
 SecureSocket::handleData(const uint8_t *data, size_t len) {
   if (0 == len) {
     // process null datagram
-    this->handleDatagram(0, 0); return;
+    this->handleDatagram(0, 0); return false;
   } else if (len<24) {
     // A valid encrypted message needs at least 24 bytes (64bit seq + 128bit tag).
-    return;
+    return false;
   } else if (len > OVL_MAX_DATA_SIZE) {
     logError() << "Encrypted message larger than OVL_MAX_DATA_SIZE!"
                << " LEN=" << len << ">" << OVL_MAX_DATA_SIZE << ".";
-    return;
+    return false;
   }
   uint8_t inBuffer[OVL_MAX_DATA_SIZE];
   // Get sequence number
@@ -704,15 +704,16 @@ SecureSocket::handleData(const uint8_t *data, size_t len) {
   int rxlen = 0;
   if (0 > (rxlen = decrypt(seq, data, len-24, inBuffer, tag))) {
     logDebug() << "Failed to decrypt message " << seq;
-    return;
+    return false;
   }
   if (rxlen > OVL_SEC_MAX_DATA_SIZE) {
     logError() << "Decrypted data larger than MAX_SEC_DATA_SIZE!"
                << " LEN=" << rxlen << ">" << OVL_SEC_MAX_DATA_SIZE;
-    return;
+    return false;
   }
   // Forward decrypted data
   this->handleDatagram(inBuffer, rxlen);
+  return true;
 }
 
 bool
@@ -748,6 +749,21 @@ SecureSocket::sendNull() {
   return _network.root().sendData(_streamId, 0, 0, _peer);
 }
 
+bool
+SecureSocket::congested() const {
+  return _network.root().sendQueueCongested(_peer);
+}
+
+void
+SecureSocket::notifyWhenWritable() {
+  _network.root().notifyWhenDrained(_streamId, _peer);
+}
+
+void
+SecureSocket::writableEvent() {
+  // pass...
+}
+
 
 /* ******************************************************************************************** *
  * Implementation of SocketHandler
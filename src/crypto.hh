@@ -121,9 +121,17 @@ protected:
 
   /** Sends a null datagram. */
   bool sendNull();
-
-  /** Processes (decrypt) an incomming datagram. */
-  void handleData(const uint8_t *data, size_t len);
+  /** Returns @c true if the send queue of the node towards the peer is congested. */
+  bool congested() const;
+  /** Requests a call to @c writableEvent once the congested send queue towards the peer drained. */
+  void notifyWhenWritable();
+  /** Gets called once the send queue towards the peer drained after it was congested.
+   * The default implementation does nothing. */
+  virtual void writableEvent();
+
+  /** Processes (decrypt) an incomming datagram.
+   * Returns @c true if the datagram was authenticated. */
+  bool handleData(const uint8_t *data, size_t len);
 
   /** Creates a session key pair and an initalization message. The message contains the public
    * key of the node, a newly generated ECC public key to derive a session key and the
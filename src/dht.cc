@@ -87,13 +87,13 @@ DHT::itemFoundEvent(const Identifier &id, const QList<NodeItem> &nodes) {
  * Implementation of DHT::NodeRef
  * ********************************************************************************************** */
 DHT::NodeRef::NodeRef()
-  : NodeItem()
+  : NodeItem(), _timestamp(0)
 {
   // pass...
 }
 
 DHT::NodeRef::NodeRef(const NodeItem &node)
-  : NodeItem(node), _timestamp(QDateTime::currentDateTime())
+  : NodeItem(node), _timestamp(Ticks::now())
 {
   // pass...
 }
@@ -111,11 +111,6 @@ DHT::NodeRef::operator =(const NodeRef &other) {
   return *this;
 }
 
-bool
-DHT::NodeRef::isOlderThan(size_t sec) const {
-  return _timestamp.secsTo(QDateTime::currentDateTime())>sec;
-}
-
 
 /* ********************************************************************************************** *
  * Implementation of DHT::NodeRefTable
@@ -21,6 +21,8 @@
 #include "httpservice.hh"
 #include "httpclient.hh"
 
+#include <QDateTime>
+
 
 /** Implements a distributed hash table. */
 class DHT: public QObject
@@ -40,10 +42,10 @@ protected:
     /** Assignment operator. */
     NodeRef &operator =(const NodeRef &other);
     /** Returns @c true if the node reference is older than the given number of seconds. */
-    bool isOlderThan(size_t sec) const;
+    inline bool isOlderThan(size_t sec) const { return (Ticks::now()-_timestamp) > sec; }
   protected:
-    /** The timestamp of the node reference. */
-    QDateTime _timestamp;
+    /** The time of the node reference in @c Ticks. */
+    uint32_t _timestamp;
   };
 
   /** Implements a node reference table. That is a list of nodes associated with an item. */
@@ -5,6 +5,8 @@
 #define OVL_COOKIE_SIZE      20
 /** Size of of the hash to use, e.g. RMD160 -> 20bytes. */
 #define OVL_HASH_SIZE        20
+/** Size of the hash in 32-bit words. */
+#define OVL_HASH_WORDS       (OVL_HASH_SIZE/4)
 /** Maximum message size per UDP packet. */
 #define OVL_MAX_MESSAGE_SIZE 8192
 /** Minimum message size per UDP packet. */
@@ -17,9 +19,19 @@
 /** The max. payload size in a DATA message. */
 #define OVL_MAX_DATA_SIZE (OVL_MAX_MESSAGE_SIZE-OVL_COOKIE_SIZE)
 
+/** Default number of datagrams received or send with a single system call. */
+#define OVL_DEFAULT_IO_BATCH_SIZE 32
+/** Maximum number of datagrams received or send with a single system call. */
+#define OVL_MAX_IO_BATCH_SIZE 256
+
+/** The default number of search requests kept in flight by a single search query. */
+#define OVL_ALPHA 3
+
+/** The maximum bucket size, may be used to size fixed arrays of nodes. */
+#define OVL_MAX_K 8
 /** The bucket size.
  * It is ensured that a complete bucket can be transferred within one UDP message. */
-#define OVL_K std::min(8, OVL_MAX_TRIPLES)
+#define OVL_K std::min(OVL_MAX_K, OVL_MAX_TRIPLES)
 
 #define OVL_PING_REQU_SIZE            (OVL_COOKIE_SIZE+2*OVL_HASH_SIZE+1)
 #define OVL_PING_RESP_SIZE            OVL_PING_REQU_SIZE
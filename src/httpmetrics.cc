@@ -0,0 +1,149 @@
+#include "httpmetrics.hh"
+#include "node.hh"
+#include "metrics.hh"
+
+/** Binary logarithm of the smallest bucket bound of exported histograms in microseconds (16us). */
+#define HTTPMETRICS_MIN_EXPONENT (4)
+/** Binary logarithm of the largest bucket bound of exported histograms in microseconds (~16.8s). */
+#define HTTPMETRICS_MAX_EXPONENT (24)
+
+
+/* ********************************************************************************************* *
+ * Implementation of HttpMetricsHandler
+ * ********************************************************************************************* */
+HttpMetricsHandler::HttpMetricsHandler(Node &node, const QString &path)
+  : HttpRequestHandler(), _node(node), _path(path)
+{
+  // pass...
+}
+
+bool
+HttpMetricsHandler::acceptReqest(HttpRequest *request) {
+  return (HTTP_GET == request->method()) && (_path == request->uri().path());
+}
+
+HttpResponse *
+HttpMetricsHandler::processRequest(HttpRequest *request) {
+  return new HttpStringResponse(request->version(), HTTP_OK, QString::fromLatin1(render()),
+                                request->socket(), "text/plain; version=0.0.4");
+}
+
+QByteArray
+HttpMetricsHandler::render() const {
+  const NodeMetrics &metrics = _node.metrics();
+  QByteArray buffer; buffer.reserve(16384);
+
+  // Traffic
+  _header(buffer, "ovl_node_received_bytes_total", "counter", "Bytes received by the node.");
+  _sample(buffer, "ovl_node_received_bytes_total", "", quint64(_node.bytesReceived()));
+  _header(buffer, "ovl_node_sent_bytes_total", "counter", "Bytes sent by the node.");
+  _sample(buffer, "ovl_node_sent_bytes_total", "", quint64(_node.bytesSend()));
+  _header(buffer, "ovl_node_receive_rate_bytes", "gauge", "Receive rate in bytes per second.");
+  _sample(buffer, "ovl_node_receive_rate_bytes", "", _node.inRate());
+  _header(buffer, "ovl_node_send_rate_bytes", "gauge", "Send rate in bytes per second.");
+  _sample(buffer, "ovl_node_send_rate_bytes", "", _node.outRate());
+
+  // Messages by type
+  _header(buffer, "ovl_node_messages_received_total", "counter", "Messages received by type.");
+  for (int i=0; i<NodeMetrics::NUM_TYPES; i++) {
+    NodeMetrics::Type type = NodeMetrics::Type(i);
+    QByteArray labels = QByteArray("type=\"") + NodeMetrics::typeName(type) + "\"";
+    _sample(buffer, "ovl_node_messages_received_total", labels.constData(), metrics.in(type));
+  }
+  _header(buffer, "ovl_node_messages_sent_total", "counter", "Messages sent by type.");
+  for (int i=0; i<NodeMetrics::NUM_TYPES; i++) {
+    NodeMetrics::Type type = NodeMetrics::Type(i);
+    QByteArray labels = QByteArray("type=\"") + NodeMetrics::typeName(type) + "\"";
+    _sample(buffer, "ovl_node_messages_sent_total", labels.constData(), metrics.out(type));
+  }
+  _header(buffer, "ovl_node_datagrams_dropped_total", "counter",
+          "Received datagrams dropped by reason.");
+  for (int i=0; i<NodeMetrics::NUM_DROP_REASONS; i++) {
+    NodeMetrics::DropReason reason = NodeMetrics::DropReason(i);
+    QByteArray labels = QByteArray("reason=\"") + NodeMetrics::dropReasonName(reason) + "\"";
+    _sample(buffer, "ovl_node_datagrams_dropped_total", labels.constData(), metrics.drops(reason));
+  }
+
+  // Latencies
+  _header(buffer, "ovl_node_request_rtt_seconds", "histogram",
+          "Round-trip time of answered requests.");
+  _histogram(buffer, "ovl_node_request_rtt_seconds", "", metrics.requestRtt());
+  _header(buffer, "ovl_node_handler_seconds", "histogram",
+          "Time spent processing received messages by type.");
+  for (int i=0; i<NodeMetrics::NUM_TYPES; i++) {
+    NodeMetrics::Type type = NodeMetrics::Type(i);
+    QByteArray labels = QByteArray("type=\"") + NodeMetrics::typeName(type) + "\"";
+    _histogram(buffer, "ovl_node_handler_seconds", labels.constData(), metrics.handlerTime(type));
+  }
+
+  // Join
+  _header(buffer, "ovl_node_ready", "gauge", "Whether the node joined the network.");
+  _sample(buffer, "ovl_node_ready", "", quint64(_node.isReady() ? 1 : 0));
+  if (_node.isReady()) {
+    _header(buffer, "ovl_node_time_to_ready_seconds", "gauge", "Time it took to join the network.");
+    _sample(buffer, "ovl_node_time_to_ready_seconds", "", double(_node.timeToReady())/1e3);
+  }
+
+  // Routing table
+  _header(buffer, "ovl_routing_nodes", "gauge", "Nodes in the routing table.");
+  _sample(buffer, "ovl_routing_nodes", "", quint64(_node.numNodes()));
+  _header(buffer, "ovl_routing_buckets", "gauge", "Non-empty buckets of the routing table.");
+  _sample(buffer, "ovl_routing_buckets", "", quint64(_node.numBuckets()));
+  _header(buffer, "ovl_node_pending_requests", "gauge", "Requests waiting for a response.");
+  _sample(buffer, "ovl_node_pending_requests", "", quint64(_node.numPendingRequests()));
+
+  // Streams & services
+  _header(buffer, "ovl_streams_open", "gauge", "Open streams.");
+  _sample(buffer, "ovl_streams_open", "", quint64(_node.numSockets()));
+  _header(buffer, "ovl_streams_queued_datagrams", "gauge", "Stream datagrams queued for sending.");
+  _sample(buffer, "ovl_streams_queued_datagrams", "", quint64(_node.queuedDatagrams()));
+  _header(buffer, "ovl_services", "gauge", "Registered services.");
+  _sample(buffer, "ovl_services", "", quint64(_node.numServices()));
+
+  return buffer;
+}
+
+void
+HttpMetricsHandler::_header(QByteArray &buffer, const char *name, const char *type, const char *help) {
+  buffer.append("# HELP ").append(name).append(' ').append(help).append('\n');
+  buffer.append("# TYPE ").append(name).append(' ').append(type).append('\n');
+}
+
+void
+HttpMetricsHandler::_sample(QByteArray &buffer, const char *name, const char *labels, quint64 value) {
+  buffer.append(name);
+  if (*labels) { buffer.append('{').append(labels).append('}'); }
+  buffer.append(' ').append(QByteArray::number(value)).append('\n');
+}
+
+void
+HttpMetricsHandler::_sample(QByteArray &buffer, const char *name, const char *labels, double value) {
+  buffer.append(name);
+  if (*labels) { buffer.append('{').append(labels).append('}'); }
+  buffer.append(' ').append(QByteArray::number(value, 'g', 9)).append('\n');
+}
+
+void
+HttpMetricsHandler::_histogram(QByteArray &buffer, const char *name, const char *labels,
+                               const Histogram &histogram)
+{
+  QByteArray bucket = QByteArray(name) + "_bucket";
+  QByteArray prefix = (*labels) ? (QByteArray(labels) + ",le=\"") : QByteArray("le=\"");
+  // Cumulative counts at fixed power-of-two bounds, the fine buckets of the histogram end at these
+  // bounds. Empty buckets are exported too, so every scrape yields the same series.
+  quint64 count = 0; size_t i = 0;
+  for (int e=HTTPMETRICS_MIN_EXPONENT; e<=HTTPMETRICS_MAX_EXPONENT; e++) {
+    quint64 bound = quint64(1) << e;
+    while ((i < histogram.numBuckets()) && (histogram.bucketUpperBound(i) < bound)) {
+      count += histogram.bucketCount(i++);
+    }
+    QByteArray le = prefix + QByteArray::number(double(bound)/1e6, 'g', 9) + "\"";
+    _sample(buffer, bucket.constData(), le.constData(), count);
+  }
+  while (i < histogram.numBuckets()) {
+    count += histogram.bucketCount(i++);
+  }
+  _sample(buffer, bucket.constData(), (prefix + "+Inf\"").constData(), count);
+  _sample(buffer, (QByteArray(name) + "_sum").constData(), labels, double(histogram.sum())/1e6);
+  _sample(buffer, (QByteArray(name) + "_count").constData(), labels, count);
+}
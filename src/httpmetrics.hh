@@ -0,0 +1,55 @@
+#ifndef __OVL_HTTPMETRICS_HH__
+#define __OVL_HTTPMETRICS_HH__
+
+#include "httpservice.hh"
+
+// Forward declarations
+class Node;
+class Histogram;
+
+
+/** Serves the metrics of a node in the Prometheus text format.
+ *
+ * The handler answers GET requests to its path (@c /metrics by default) with the byte and message
+ * counters, drop counters and latency histograms of the node, whether and how fast it joined the
+ * network as well as the size of its routing table, the number of open streams, pending requests
+ * and registered services. All values are read from counters maintained by the node, hence
+ * rendering the response is cheap and does not touch the routing table entries. Add it to a
+ * @c HttpDispatcher served by a @c LocalHttpServer to allow a local Prometheus instance to scrape
+ * the node.
+ * @ingroup http */
+class HttpMetricsHandler: public HttpRequestHandler
+{
+public:
+  /** Constructor.
+   * @param node Specifies the node to export the metrics of.
+   * @param path Specifies the path the metrics are served at. */
+  HttpMetricsHandler(Node &node, const QString &path="/metrics");
+
+  /** Accepts GET requests to the metrics path. */
+  bool acceptReqest(HttpRequest *request);
+  HttpResponse *processRequest(HttpRequest *request);
+
+  /** Renders the current metrics of the node in the Prometheus text format. */
+  QByteArray render() const;
+
+protected:
+  /** Appends the type and help lines of a metric. */
+  static void _header(QByteArray &buffer, const char *name, const char *type, const char *help);
+  /** Appends a sample of a metric. */
+  static void _sample(QByteArray &buffer, const char *name, const char *labels, quint64 value);
+  /** Appends a sample of a metric. */
+  static void _sample(QByteArray &buffer, const char *name, const char *labels, double value);
+  /** Appends the buckets, sum and count of a histogram of microseconds as seconds. The buckets are
+   * exported at fixed power-of-two bounds. */
+  static void _histogram(QByteArray &buffer, const char *name, const char *labels,
+                         const Histogram &histogram);
+
+protected:
+  /** The node. */
+  Node &_node;
+  /** The path the metrics are served at. */
+  QString _path;
+};
+
+#endif // __OVL_HTTPMETRICS_HH__
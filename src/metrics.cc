@@ -0,0 +1,154 @@
+#include "metrics.hh"
+
+#include <algorithm>
+
+
+/* ******************************************************************************************** *
+ * Implementation of Histogram
+ * ******************************************************************************************** */
+Histogram::Histogram()
+  : _count(0), _sum(0)
+{
+  for (size_t i=0; i<OVL_HISTOGRAM_BUCKETS; i++) {
+    _buckets[i].store(0);
+  }
+}
+
+size_t
+Histogram::bucketIndex(quint64 value) {
+  // Small values are counted exactly
+  if (value < OVL_HISTOGRAM_SUB_BUCKETS) { return value; }
+  // Determine exponent (index of the most significant bit)
+  size_t e = 3;
+  while ((e < 63) && (value >> (e+1))) { e++; }
+  if (e >= OVL_HISTOGRAM_MAX_EXPONENT) { return OVL_HISTOGRAM_BUCKETS-1; }
+  // The 3 bits below the most significant one select the sub-bucket
+  return (e-2)*OVL_HISTOGRAM_SUB_BUCKETS + ((value >> (e-3)) & (OVL_HISTOGRAM_SUB_BUCKETS-1));
+}
+
+void
+Histogram::record(quint64 value) {
+  _buckets[bucketIndex(value)].fetchAndAddRelaxed(1);
+  _sum.fetchAndAddRelaxed(value);
+  _count.fetchAndAddRelaxed(1);
+}
+
+quint64
+Histogram::count() const {
+  return _count.load();
+}
+
+quint64
+Histogram::sum() const {
+  return _sum.load();
+}
+
+quint64
+Histogram::percentile(double q) const {
+  quint64 total = 0;
+  for (size_t i=0; i<OVL_HISTOGRAM_BUCKETS; i++) {
+    total += _buckets[i].load();
+  }
+  if (0 == total) { return 0; }
+  // Rank of the requested quantile, at least the first value
+  quint64 rank = std::max(quint64(1), quint64(q*total + 0.5));
+  quint64 seen = 0;
+  for (size_t i=0; i<OVL_HISTOGRAM_BUCKETS; i++) {
+    seen += _buckets[i].load();
+    if (seen >= rank) { return bucketUpperBound(i); }
+  }
+  return bucketUpperBound(OVL_HISTOGRAM_BUCKETS-1);
+}
+
+size_t
+Histogram::numBuckets() const {
+  return OVL_HISTOGRAM_BUCKETS;
+}
+
+quint64
+Histogram::bucketCount(size_t i) const {
+  return _buckets[i].load();
+}
+
+quint64
+Histogram::bucketUpperBound(size_t i) const {
+  if (i < OVL_HISTOGRAM_SUB_BUCKETS) { return i; }
+  size_t e = i/OVL_HISTOGRAM_SUB_BUCKETS + 2;
+  quint64 m = i % OVL_HISTOGRAM_SUB_BUCKETS;
+  return ((OVL_HISTOGRAM_SUB_BUCKETS+m+1) << (e-3)) - 1;
+}
+
+
+/* ******************************************************************************************** *
+ * Implementation of NodeMetrics
+ * ******************************************************************************************** */
+NodeMetrics::NodeMetrics()
+  : _requestRtt()
+{
+  for (int i=0; i<NUM_TYPES; i++) {
+    _in[i].store(0); _out[i].store(0);
+  }
+  for (int i=0; i<NUM_DROP_REASONS; i++) {
+    _drops[i].store(0);
+  }
+}
+
+quint64
+NodeMetrics::in(Type type) const {
+  return _in[type].load();
+}
+
+quint64
+NodeMetrics::out(Type type) const {
+  return _out[type].load();
+}
+
+quint64
+NodeMetrics::drops(DropReason reason) const {
+  return _drops[reason].load();
+}
+
+Histogram &
+NodeMetrics::requestRtt() {
+  return _requestRtt;
+}
+
+const Histogram &
+NodeMetrics::requestRtt() const {
+  return _requestRtt;
+}
+
+Histogram &
+NodeMetrics::handlerTime(Type type) {
+  return _handlerTime[type];
+}
+
+const Histogram &
+NodeMetrics::handlerTime(Type type) const {
+  return _handlerTime[type];
+}
+
+const char *
+NodeMetrics::typeName(Type type) {
+  switch (type) {
+  case PING: return "ping";
+  case SEARCH: return "search";
+  case CONNECT: return "connect";
+  case RENDEZVOUS: return "rendezvous";
+  case DATA: return "data";
+  default: break;
+  }
+  return "unknown";
+}
+
+const char *
+NodeMetrics::dropReasonName(DropReason reason) {
+  switch (reason) {
+  case DROP_SIZE: return "size";
+  case DROP_UNKNOWN_COOKIE: return "unknown_cookie";
+  case DROP_UNKNOWN_NETWORK: return "unknown_network";
+  case DROP_MALFORMED: return "malformed";
+  default: break;
+  }
+  return "unknown";
+}
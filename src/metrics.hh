@@ -0,0 +1,150 @@
+#ifndef __OVL_METRICS_HH__
+#define __OVL_METRICS_HH__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <QAtomicInteger>
+
+
+/** The number of linear sub-buckets per power of 2 of a @c Histogram. */
+#define OVL_HISTOGRAM_SUB_BUCKETS 8
+/** The number of powers of 2 covered by a @c Histogram, larger values are counted in the last
+ * bucket. */
+#define OVL_HISTOGRAM_MAX_EXPONENT 40
+/** The number of buckets of a @c Histogram. */
+#define OVL_HISTOGRAM_BUCKETS ((OVL_HISTOGRAM_MAX_EXPONENT-2)*OVL_HISTOGRAM_SUB_BUCKETS)
+
+
+/** A histogram of non-negative values with logarithmic buckets.
+ *
+ * Like a HDR histogram, every power of 2 is divided into @c OVL_HISTOGRAM_SUB_BUCKETS linear
+ * buckets, hence the relative error of a recorded value is below 1/8 over the entire range. All
+ * counters are atomic, values can be recorded and read concurrently without locks. A reader may
+ * however observe a sample in the bucket counts but not yet in the sum.
+ * @ingroup core */
+class Histogram
+{
+public:
+  /** Constructor, creates an empty histogram. */
+  Histogram();
+
+  /** Records a value. */
+  void record(quint64 value);
+
+  /** Returns the number of values recorded. */
+  quint64 count() const;
+  /** Returns the sum of all values recorded. */
+  quint64 sum() const;
+  /** Returns an upper bound of the given quantile (0..1) of the recorded values
+   * or 0 if the histogram is empty. */
+  quint64 percentile(double q) const;
+
+  /** Returns the number of buckets. */
+  size_t numBuckets() const;
+  /** Returns the number of values recorded in the i-th bucket. */
+  quint64 bucketCount(size_t i) const;
+  /** Returns the largest value counted in the i-th bucket. */
+  quint64 bucketUpperBound(size_t i) const;
+
+  /** Returns the index of the bucket the given value is counted in. */
+  static size_t bucketIndex(quint64 value);
+
+private:
+  /** Histograms cannot be copied. */
+  Histogram(const Histogram &other);
+  /** Histograms cannot be copied. */
+  Histogram &operator=(const Histogram &other);
+
+protected:
+  /** The number of values recorded. */
+  QAtomicInteger<quint64> _count;
+  /** The sum of all values recorded. */
+  QAtomicInteger<quint64> _sum;
+  /** The bucket counts. */
+  QAtomicInteger<quint64> _buckets[OVL_HISTOGRAM_BUCKETS];
+};
+
+
+/** Message counters and latency histograms of a @c Node.
+ *
+ * The counters are updated by the thread of the node and may be read by any thread at any
+ * time. All counters are atomic and updated with relaxed ordering, hence reading them does
+ * not interfere with the processing of datagrams.
+ * @ingroup core */
+class NodeMetrics
+{
+public:
+  /** The message types counted. */
+  typedef enum {
+    PING = 0,   ///< Ping requests and responses.
+    SEARCH,     ///< Search requests and responses.
+    CONNECT,    ///< Start-connection requests and responses.
+    RENDEZVOUS, ///< Rendezvous requests.
+    DATA,       ///< Stream data.
+    NUM_TYPES   ///< The number of message types.
+  } Type;
+
+  /** The reasons a received datagram gets dropped. */
+  typedef enum {
+    DROP_SIZE = 0,        ///< The datagram is too small or too large.
+    DROP_UNKNOWN_COOKIE,  ///< Neither a stream nor a request matches the cookie.
+    DROP_UNKNOWN_NETWORK, ///< The request addresses an unknown network.
+    DROP_MALFORMED,       ///< A response to a pending request of invalid type or size.
+    NUM_DROP_REASONS      ///< The number of drop reasons.
+  } DropReason;
+
+public:
+  /** Constructor. */
+  NodeMetrics();
+
+  /** Counts a received message of the given type. */
+  inline void countIn(Type type) { _in[type].fetchAndAddRelaxed(1); }
+  /** Counts a send message of the given type. */
+  inline void countOut(Type type) { _out[type].fetchAndAddRelaxed(1); }
+  /** Counts a dropped datagram. */
+  inline void countDrop(DropReason reason) { _drops[reason].fetchAndAddRelaxed(1); }
+
+  /** Returns the number of messages of the given type received. */
+  quint64 in(Type type) const;
+  /** Returns the number of messages of the given type send. */
+  quint64 out(Type type) const;
+  /** Returns the number of datagrams dropped for the given reason. */
+  quint64 drops(DropReason reason) const;
+
+  /** Returns the histogram of the round-trip times of answered requests in microseconds. */
+  Histogram &requestRtt();
+  /** Returns the histogram of the round-trip times of answered requests in microseconds. */
+  const Histogram &requestRtt() const;
+  /** Returns the histogram of the time in microseconds spent processing received messages of
+   * the given type. */
+  Histogram &handlerTime(Type type);
+  /** Returns the histogram of the time in microseconds spent processing received messages of
+   * the given type. */
+  const Histogram &handlerTime(Type type) const;
+
+  /** Returns the name of the given message type. */
+  static const char *typeName(Type type);
+  /** Returns the name of the given drop reason. */
+  static const char *dropReasonName(DropReason reason);
+
+private:
+  /** Metrics cannot be copied. */
+  NodeMetrics(const NodeMetrics &other);
+  /** Metrics cannot be copied. */
+  NodeMetrics &operator=(const NodeMetrics &other);
+
+protected:
+  /** Received messages by type. */
+  QAtomicInteger<quint64> _in[NUM_TYPES];
+  /** Send messages by type. */
+  QAtomicInteger<quint64> _out[NUM_TYPES];
+  /** Dropped datagrams by reason. */
+  QAtomicInteger<quint64> _drops[NUM_DROP_REASONS];
+  /** Request round-trip times. */
+  Histogram _requestRtt;
+  /** Handler times by message type. */
+  Histogram _handlerTime[NUM_TYPES];
+};
+
+#endif // __OVL_METRICS_HH__
@@ -3,18 +3,19 @@
 
 #define NET_NODE_REFRESH_INTERVAL (15*60)
 #define NET_NODE_TIMEOUT          (20*60)
+/** A node not seen for this time (in seconds) gets replaced once it fails to answer a ping. */
+#define NET_NODE_SILENT_AGE       (2*60)
 
 
 /* ******************************************************************************************** *
  * Implementation of SearchQuery
  * ******************************************************************************************** */
 SearchQuery::SearchQuery(const Identifier &id, const QString &prefix)
-  : QObject(), _id(id), _prefix(), _best(), _queried()
+  : QObject(), _id(id), _prefix(Identifier::fromName(prefix)), _best(), _distances(), _rtts(),
+    _queried(), _alpha(OVL_ALPHA), _inflight(0), _proximity(true), _finished(false)
 {
-  char hash[OVL_HASH_SIZE];
-  QByteArray prefName = prefix.toUtf8();
-  OVLHash((const uint8_t *)prefName.constData(), prefName.size(), (uint8_t *)hash);
-  _prefix = Identifier(hash);
+  _distances.reserve(OVL_K+1);
+  _rtts.reserve(OVL_K+1);
 }
 
 SearchQuery::~SearchQuery() {
@@ -37,38 +38,49 @@ SearchQuery::netid() const {
 }
 
 void
-SearchQuery::update(const NodeItem &node) {
+SearchQuery::update(const NodeItem &node, int rtt) {
   // Skip nodes already queried or in the best list -> done
   if (_queried.contains(node.id())) { return; }
-  // Perform an "insort" into best list
+  // Perform an "insort" into best list using the precomputed distances
   Distance d = _id-node.id();
-  QList<NodeItem>::iterator item = _best.begin();
-  while ((item != _best.end()) && (d>=(_id-item->id()))) {
-    // if the node is in list -> quit
-    if (item->id() == node.id()) { return; }
+  int idx = 0;
+  while ((idx < _distances.size()) && (d >= _distances[idx])) {
+    // if the node is in list -> update RTT and quit
+    if (_best[idx].id() == node.id()) {
+      if (0 <= rtt) { _rtts[idx] = rtt; }
+      return;
+    }
     // continue
-    item++;
+    idx++;
+  }
+  // If the list is full and the node is not closer than any of it -> done
+  if (idx >= OVL_K) { return; }
+  _best.insert(idx, node);
+  _distances.insert(idx, d);
+  _rtts.insert(idx, rtt);
+  while (_best.size() > OVL_K) {
+    _best.pop_back(); _distances.pop_back(); _rtts.pop_back();
   }
-  _best.insert(item, node);
-  while (_best.size() > OVL_K) { _best.pop_back(); }
 }
 
 bool
 SearchQuery::next(NodeItem &node) {
-  QList<NodeItem>::iterator item = _best.begin();
-  for (; item != _best.end(); item++) {
-    if (! _queried.contains(item->id())) {
-      _queried.insert(item->id());
-      node = *item;
-      return true;
+  // Find closest node not queried yet
+  int idx = 0;
+  while ((idx < _best.size()) && _queried.contains(_best[idx].id())) { idx++; }
+  if (idx >= _best.size()) { return false; }
+  // Prefer a faster node among the nodes with the same leading bit of the distance, they yield
+  // roughly the same progress towards the target
+  if (_proximity) {
+    size_t bit = _distances[idx].leadingBit();
+    for (int i=idx+1; (i<_best.size()) && (bit == _distances[i].leadingBit()); i++) {
+      if ((0 > _rtts[i]) || _queried.contains(_best[i].id())) { continue; }
+      if ((0 > _rtts[idx]) || (_rtts[i] < _rtts[idx])) { idx = i; }
     }
   }
-  return false;
-}
-
-QList<NodeItem> &
-SearchQuery::best() {
-  return _best;
+  _queried.insert(_best[idx].id());
+  node = _best[idx];
+  return true;
 }
 
 const QList<NodeItem> &
@@ -81,16 +93,68 @@ SearchQuery::first() const {
   return _best.first();
 }
 
+size_t
+SearchQuery::alpha() const {
+  return _alpha;
+}
+
+void
+SearchQuery::setAlpha(size_t alpha) {
+  _alpha = std::max(size_t(1), alpha);
+}
+
+size_t
+SearchQuery::inflight() const {
+  return _inflight;
+}
+
+bool
+SearchQuery::proximity() const {
+  return _proximity;
+}
+
+void
+SearchQuery::setProximity(bool enable) {
+  _proximity = enable;
+}
+
+bool
+SearchQuery::isFinished() const {
+  return _finished;
+}
+
+void
+SearchQuery::requestSent() {
+  _inflight++;
+}
+
+void
+SearchQuery::requestFinished() {
+  if (_inflight)
+    _inflight--;
+  // Delete query once the last pending request is gone
+  if (_finished && (0 == _inflight))
+    this->deleteLater();
+}
+
 void
 SearchQuery::searchFailed() {
+  if (_finished)
+    return;
+  _finished = true;
   emit failed(_id, _best);
-  this->deleteLater();
+  if (0 == _inflight)
+    this->deleteLater();
 }
 
 void
 SearchQuery::searchSucceeded() {
+  if (_finished)
+    return;
+  _finished = true;
   emit succeeded(_id, _best);
-  this->deleteLater();
+  if (0 == _inflight)
+    this->deleteLater();
 }
 
 
@@ -129,6 +193,8 @@ FindNodeQuery::searchCompleted() {
 
 void
 FindNodeQuery::searchSucceeded() {
+  if (_finished)
+    return;
   emit found(_best.first());
   SearchQuery::searchSucceeded();
 }
@@ -154,6 +220,8 @@ NeighbourhoodQuery::isSearchComplete() const {
 
 void
 NeighbourhoodQuery::searchCompleted() {
+  if (_finished)
+    return;
   emit completed(_id, _best);
   if (_best.size())
     this->searchSucceeded();
@@ -166,7 +234,7 @@ NeighbourhoodQuery::searchCompleted() {
  * Implementation of Network
  * ******************************************************************************************** */
 Network::Network(const Identifier &id, QObject *parent)
-  : QObject(parent), _buckets(id), _nodeTimer()
+  : QObject(parent), _buckets(id), _nodeTimer(), _netid()
 {
   // check for dead nodes every minute
   _nodeTimer.setInterval(1000*60);
@@ -178,10 +246,10 @@ Network::Network(const Identifier &id, QObject *parent)
 
 Identifier
 Network::netid() const {
-  char hash[20];
-  QByteArray prefix = this->prefix().toUtf8();
-  OVLHash((const uint8_t *)prefix.constData(), prefix.size(), (uint8_t *)hash);
-  return Identifier(hash);
+  if (! _netid.isValid()) {
+    _netid = Identifier::fromName(this->prefix());
+  }
+  return _netid;
 }
 
 void
@@ -192,7 +260,7 @@ Network::getNearest(const Identifier &id, QList<NodeItem> &nodes) const {
 void
 Network::addCandidate(const NodeItem &node) {
   if (! _buckets.contains(node.id())) {
-    _buckets.addCandidate(node.id(), node.addr(), node.port());
+    _buckets.addCandidate(node);
   }
 }
 
@@ -204,13 +272,31 @@ Network::nodeReachableEvent(const NodeItem &node) {
   bool bootstrapping = _buckets.empty();
   // Given that this is a ping response -> add the node to the corresponding
   // bucket if space is left
-  if (_buckets.add(node.id(), node.addr(), node.port())) {
+  if (_buckets.add(node)) {
     emit nodeAppeard(node);
   }
   if (bootstrapping) {
     emit connected();
-    logDebug() << "Still boot strapping: Search for myself.";
-    search(new NeighbourhoodQuery(_buckets.id(), prefix()));
+    if (! joining()) {
+      logDebug() << "Still boot strapping: Search for myself.";
+      search(new NeighbourhoodQuery(_buckets.id(), prefix()));
+    }
+  }
+}
+
+bool
+Network::joining() const {
+  return false;
+}
+
+void
+Network::nodeUnreachableEvent(const Identifier &id) {
+  NodeItem replacement;
+  if (! _buckets.evict(id, NET_NODE_SILENT_AGE, replacement)) { return; }
+  emit nodeLost(id);
+  // Confirm a replacement, that was never reachable
+  if (! _buckets.isValid(replacement.id())) {
+    this->ping(replacement);
   }
 }
 
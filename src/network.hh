@@ -34,15 +34,17 @@ public:
   /** Returns the network identifier. */
   const Identifier &netid() const;
 
-  /** Update the search queue (ordered list of nodes to query). */
-  virtual void update(const NodeItem &nodes);
-
-  /** Returns the next node to query or @c false if no node left to query. */
+  /** Update the search queue (ordered list of nodes to query).
+   * @param node Specifies the node to add.
+   * @param rtt Specifies the measured round-trip time in ms to the node, -1 if unknown. */
+  virtual void update(const NodeItem &node, int rtt=-1);
+
+  /** Returns the next node to query or @c false if no node left to query. This is the closest
+   * node not queried yet. If proximity routing is enabled, a node nearly as close (i.e., its
+   * distance to the target has the same leading bit) is preferred if its RTT is lower or the RTT
+   * of the closest node is unknown. */
   virtual bool next(NodeItem &node);
 
-  /** Returns the current search query. This list is also the list of the closest nodes to the
-   * target known. */
-  QList<NodeItem> &best();
   /** Returns the current search query. This list is also the list of the closest nodes to the
    * target known. */
   const QList<NodeItem> &best() const;
@@ -50,6 +52,25 @@ public:
   /** Returns the first element from the search queue. */
   const NodeItem &first() const;
 
+  /** Returns the maximum number of requests kept in flight. */
+  size_t alpha() const;
+  /** Sets the maximum number of requests kept in flight, defaults to @c OVL_ALPHA. */
+  void setAlpha(size_t alpha);
+  /** Returns the number of requests in flight. */
+  size_t inflight() const;
+  /** Returns @c true if near-ties in distance are broken by the RTT of the nodes. */
+  bool proximity() const;
+  /** Enables or disables breaking near-ties in distance by the RTT of the nodes, enabled by
+   * default. */
+  void setProximity(bool enable);
+  /** Returns @c true if the search query succeeded or failed. */
+  bool isFinished() const;
+  /** Gets called once a request has been send for this query. */
+  void requestSent();
+  /** Gets called once a request has been answered or timed out. If the query is finished and
+   * this was the last request in flight, the query gets deleted. */
+  void requestFinished();
+
   /** Returns true, if the search is complete. */
   virtual bool isSearchComplete() const = 0;
 
@@ -57,11 +78,11 @@ public:
   virtual void searchCompleted() = 0;
 
   /** Should be called if the search query succeeds.
-   * This will delete the search query instance. */
+   * This will delete the search query instance once there are no requests left in flight. */
   virtual void searchSucceeded();
 
   /** Gets called if the search query failed.
-   * This will delete the search query instance. */
+   * This will delete the search query instance once there are no requests left in flight. */
   virtual void searchFailed();
 
 signals:
@@ -79,8 +100,20 @@ protected:
   Identifier _prefix;
   /** The current search queue. */
   QList<NodeItem> _best;
+  /** The distances of the nodes in the search queue to the target, computed once on insertion. */
+  QVector<Distance> _distances;
+  /** The round-trip times in ms of the nodes in the search queue, -1 if unknown. */
+  QVector<int> _rtts;
   /** The set of nodes already asked. */
   QSet<Identifier> _queried;
+  /** The maximum number of requests kept in flight. */
+  size_t _alpha;
+  /** The number of requests in flight. */
+  size_t _inflight;
+  /** If @c true, near-ties in distance are broken by RTT. */
+  bool _proximity;
+  /** If @c true, the query succeeded or failed. */
+  bool _finished;
 };
 
 
@@ -144,7 +177,7 @@ public:
 
   /** Returns the network prefix (name). Returns an empty string for the roo network. */
   virtual const QString &prefix() const = 0;
-  /** Returns the network identifier. */
+  /** Returns the network identifier, the hash of the network prefix computed on first use. */
   virtual Identifier netid() const;
 
   /** Returns @c true if a handler is associated with the given service name. */
@@ -168,6 +201,13 @@ public slots:
 protected:
   /** Gets called once a node replied to a ping request within this network. */
   virtual void nodeReachableEvent(const NodeItem &node);
+  /** Gets called once a node did not reply to a ping request within this network. A silent node
+   * gets replaced by a node from the replacement cache of its bucket. */
+  virtual void nodeUnreachableEvent(const Identifier &id);
+  /** Returns @c true while a join runs its own lookups. In this case, the first reachable node
+   * does not start a search for the own identifier. The default implementation returns
+   * @c false. */
+  virtual bool joining() const;
 
 signals:
   /** Gets emitted as the Node enters the network. */
@@ -190,6 +230,8 @@ protected:
   Buckets _buckets;
   /** Bucket update timer. */
   QTimer _nodeTimer;
+  /** The network identifier, obtained on first use as the prefix is not known at construction. */
+  mutable Identifier _netid;
 
   friend class Node;
 };
@@ -3,12 +3,112 @@
 #include "dht_config.hh"
 
 #include <QHostInfo>
+#include <QDnsLookup>
+#include <QAbstractEventDispatcher>
+#include <QSaveFile>
+#include <QtEndian>
 #include <netinet/in.h>
 #include <inttypes.h>
+#include <new>
 
 #define NODE_STATISTICS_INTERVAL      (1000*5)
 #define NODE_RENDEZVOUS_PING_INTERVAL (1000*60)
-#define NODE_REQUEST_CHECK_INTERVAL   (500)
+#define NODE_REQUEST_CHECK_INTERVAL   (100)
+/** Timeout of requests to nodes with unknown RTT. */
+#define NODE_REQUEST_TIMEOUT          (2000)
+/** Lower and upper bound of request timeouts derived from the RTT estimates. */
+#define NODE_REQUEST_MIN_TIMEOUT      (200)
+#define NODE_REQUEST_MAX_TIMEOUT      (6000)
+/** Number of slots of the request timing wheel, must be a power of 2. Spans 6.4s with a tick of
+ * 100ms. */
+#define NODE_REQUEST_WHEEL_SIZE       (64)
+/** Number of request items allocated at once by the request pool. */
+#define NODE_REQUEST_SLAB_SIZE        (256)
+/** Lower bound of the lifetime of resolved hostnames in the cache (1s). The TTL of the DNS records
+ * is clamped to [NODE_HOST_CACHE_MIN_TTL, NODE_HOST_CACHE_MAX_TTL]. */
+#define NODE_HOST_CACHE_MIN_TTL       (1000)
+/** Upper bound of the lifetime of resolved hostnames in the cache (1 hour). */
+#define NODE_HOST_CACHE_MAX_TTL       (1000*60*60)
+/** Lifetime of resolved hostnames in the cache, unless the TTL of their DNS records is known. The
+ * system resolver does not report the TTL and names from /etc/hosts have none. */
+#define NODE_HOST_CACHE_TTL           (1000*60)
+/** Default rate in bytes per second, stream data is paced with towards a single destination. A rate
+ * of 0 disables pacing, datagrams are then only queued if the transport buffer is full. */
+#define NODE_PACING_RATE              (0)
+/** Default burst size in bytes of the pacing token bucket. */
+#define NODE_PACING_BURST             (64*1024)
+/** Interval in ms, queued datagrams are send at. */
+#define NODE_PACING_INTERVAL          (5)
+/** Maximum number of datagrams queued per destination. Streams are notified once the queue
+ * drained to a quarter. */
+#define NODE_SEND_QUEUE_SIZE          (128)
+/** Idle destinations are forgotten after 60s. */
+#define NODE_DESTINATION_TIMEOUT      (1000*60)
+/** Lifetime of failed hostname lookups in the cache. */
+#define NODE_HOST_CACHE_NEGATIVE_TTL  (1000*30)
+/** Specifies the time in ms a search response is cached. */
+#define NODE_SEARCH_CACHE_TTL         (1000*5)
+/** Specifies the maximum number of cached search responses. */
+#define NODE_SEARCH_CACHE_SIZE        (1024)
+/** Specifies the interval in ms, snapshots of the buckets are saved at. */
+#define NODE_SNAPSHOT_INTERVAL        (1000*60*5)
+/** Nodes of a snapshot not seen for more than this time (in seconds) are not loaded. */
+#define NODE_SNAPSHOT_MAX_AGE         (60*60*24)
+/** The version of the snapshot file format. */
+#define NODE_SNAPSHOT_VERSION         (1)
+/** Specifies the number of nodes loaded from a snapshot pinged at once. */
+#define NODE_PING_SWEEP_BATCH         (16)
+/** Specifies the interval in ms between two batches of the ping sweep. */
+#define NODE_PING_SWEEP_INTERVAL      (100)
+/** Specifies the number of nodes loaded from a snapshot pinged at once when joining the network. */
+#define NODE_BOOTSTRAP_PEERS          (64)
+/** Specifies the time in ms the self-lookups of the join wait for more seeds to reply after the
+ * first one did. */
+#define NODE_BOOTSTRAP_DELAY          (250)
+/** Specifies the number of self-lookups of the join, run in parallel. */
+#define NODE_BOOTSTRAP_SELF_LOOKUPS   (3)
+/** Specifies the timeout in ms of each stage of the join. */
+#define NODE_BOOTSTRAP_TIMEOUT        (1000*10)
+
+/** The header of a snapshot file of the buckets, integers are stored in network byte order.
+ * @ingroup internal */
+struct __attribute__((packed)) SnapshotHeader {
+  /** The magic "OVLS". */
+  char     magic[4];
+  /** The format version. */
+  uint16_t version;
+  /** Reserved, 0. */
+  uint16_t reserved;
+  /** The time the snapshot was saved in seconds since epoch (UTC). */
+  uint64_t saved;
+  /** The number of entries following the header. */
+  uint32_t count;
+};
+
+/** An entry of a snapshot file, integers are stored in network byte order.
+ * @ingroup internal */
+struct __attribute__((packed)) SnapshotEntry {
+  /** The network identifier. */
+  char     network[OVL_HASH_SIZE];
+  /** The node identifier. */
+  char     id[OVL_HASH_SIZE];
+  /** The IPv6 or IPv4-mapped address. */
+  uint8_t  ip[16];
+  /** The port. */
+  uint16_t port;
+  /** The time in seconds since the node was last seen. */
+  uint32_t age;
+  /** The smoothed round-trip time in ms, -1 if unknown. */
+  int32_t  srtt;
+  /** The round-trip time variation in ms, -1 if unknown. */
+  int32_t  rttvar;
+};
+
+/** Orders snapshot entries by age, most recently seen first. */
+static bool
+snapshotEntryLessThan(const SnapshotEntry &a, const SnapshotEntry &b) {
+  return a.age < b.age;
+}
 
 /** Represents a triple of ID, IP address and port as transferred via UDP.
  * @ingroup internal */
@@ -99,14 +199,50 @@ struct __attribute__((packed)) Message
     uint8_t datagram[OVL_MAX_DATA_SIZE];
   } payload;
 
-  /** Constructor. */
-  Message();
-};
+  /** Constructor, leaves the message uninitialized. Only the bytes actually send are written by
+   * the assemble methods below. */
+  inline Message() { }
+
+  /** Assembles a ping request or response, returns the message size. */
+  inline size_t assemblePing(const char *cookie, const Identifier &id, const Identifier &netid) {
+    memcpy(this->cookie, cookie, OVL_COOKIE_SIZE);
+    payload.ping.type = PING;
+    memcpy(payload.ping.id, id.constData(), OVL_HASH_SIZE);
+    memcpy(payload.ping.network, netid.constData(), OVL_HASH_SIZE);
+    return OVL_PING_REQU_SIZE;
+  }
 
-Message::Message()
-{
-  memset(this, 0, sizeof(Message));
-}
+  /** Assembles a search request allowing for @c ntriples triples in the response, returns the
+   * message size. */
+  inline size_t assembleSearch(const char *cookie, const Identifier &id, const Identifier &netid,
+                               size_t ntriples) {
+    memcpy(this->cookie, cookie, OVL_COOKIE_SIZE);
+    payload.search.type = SEARCH;
+    memcpy(payload.search.id, id.constData(), OVL_HASH_SIZE);
+    memcpy(payload.search.network, netid.constData(), OVL_HASH_SIZE);
+    // Only the dummy bytes actually send get zeroed
+    size_t size = OVL_COOKIE_SIZE+1+OVL_HASH_SIZE+ntriples*OVL_TRIPLE_SIZE;
+    memset(payload.search.dummy, 0, size-OVL_SEARCH_MIN_REQU_SIZE);
+    return size;
+  }
+
+  /** Assembles a rendezvous request, returns the message size. */
+  inline size_t assembleRendezvous(const char *cookie, const Identifier &id) {
+    memcpy(this->cookie, cookie, OVL_COOKIE_SIZE);
+    payload.rendezvous.type = RENDEZVOUS;
+    memcpy(payload.rendezvous.id, id.constData(), OVL_HASH_SIZE);
+    memset(payload.rendezvous.ip, 0, 16);
+    payload.rendezvous.port = 0;
+    return OVL_RENDEZVOUS_REQU_SIZE;
+  }
+
+  /** Assembles a connection datagram, returns the message size. */
+  inline size_t assembleData(const char *cookie, const uint8_t *data, size_t len) {
+    memcpy(this->cookie, cookie, OVL_COOKIE_SIZE);
+    memcpy(payload.datagram, data, len);
+    return OVL_COOKIE_SIZE+len;
+  }
+};
 
 
 /** Base class of all request items. A request item will be stored for every request send. This
@@ -130,21 +266,28 @@ public:
   /** Returns the request type. */
   inline Type type() const { return _type; }
   /** Returns the request cookie. */
-  inline const Identifier &cookie() const { return _cookie; }
-  /** Returns the timestamp of the request. */
-  inline const QDateTime &timestamp() const { return _timestamp; }
-  /** Returns @c true if the request is older than the specified number of seconds. */
-  inline size_t olderThan(size_t seconds) const {
-    return (_timestamp.addMSecs(seconds) < QDateTime::currentDateTime());
-  }
+  inline const char *cookie() const { return _cookie; }
+  /** Returns the deadline of the request in ms w.r.t. the node clock. */
+  inline qint64 deadline() const { return _deadline; }
+  /** Returns the time the request was send in microseconds w.r.t. the node clock. */
+  inline qint64 sent() const { return _sent; }
 
 protected:
   /** The request type. */
   Type _type;
   /** The magic cookie. */
-  Identifier  _cookie;
-  /** The request timestamp. */
-  QDateTime   _timestamp;
+  char        _cookie[OVL_COOKIE_SIZE];
+  /** The time the request was send in microseconds w.r.t. the node clock. */
+  qint64      _sent;
+  /** The request deadline in ms w.r.t. the node clock. */
+  qint64      _deadline;
+  /** The previous request in the same timing wheel slot. */
+  Request    *_prev;
+  /** The next request in the same timing wheel slot. */
+  Request    *_next;
+
+  // Allow Node to manage the timing wheel
+  friend class Node;
 };
 
 
@@ -177,13 +320,17 @@ class SearchRequest: public Request
 {
 public:
   /** Hidden constructor. */
-  SearchRequest(SearchQuery *query);
+  SearchRequest(SearchQuery *query, const Identifier &to);
   /** Returns the query instance associated with the request. */
   inline SearchQuery *query() const { return _query; }
+  /** Returns the identifier of the node queried. */
+  inline const Identifier &to() const { return _to; }
 
 protected:
   /** The search query associated with the request. */
   SearchQuery *_query;
+  /** The identifier of the node queried. */
+  Identifier _to;
 };
 
 
@@ -201,7 +348,7 @@ public:
   /** Returns the socket of the request. */
   inline SecureSocket *socket() const { return _socket; }
   /** Returns the service number of the request. */
-  inline const char *service() const { return _service; }
+  inline const char *service() const { return _service.constData(); }
   /** Returns the identifier of the remote node. */
   inline const Identifier &peedId() const { return _peer; }
 
@@ -215,6 +362,47 @@ protected:
 };
 
 
+/** A simple pool allocator for request items.
+ * Request items are allocated and freed frequently, hence they are taken from slabs of
+ * @c NODE_REQUEST_SLAB_SIZE items and kept in a free list once released. Slabs are never returned
+ * to the system, the pool keeps the high-water mark of concurrent requests. The pool is not
+ * synchronized, every @c Node owns its pool and constructs its requests in place.
+ * @ingroup internal */
+class RequestPool
+{
+public:
+  /** Constructor. */
+  RequestPool();
+  /** Destructor, frees all slabs. */
+  ~RequestPool();
+
+  /** Returns a block for a request item of the given size. */
+  void *alloc(size_t size);
+  /** Returns the given block to the pool. */
+  void free(void *ptr);
+
+protected:
+  /** A block large enough to hold any request item. */
+  union Block {
+    /** The next free block. */
+    Block *next;
+    /** Storage for a ping request. */
+    char ping[sizeof(PingRequest)];
+    /** Storage for a search request. */
+    char search[sizeof(SearchRequest)];
+    /** Storage for a start connection request. */
+    char connect[sizeof(StartConnectionRequest)];
+    /** Ensures alignment. */
+    qint64 align;
+  };
+
+  /** The list of free blocks. */
+  Block *_free;
+  /** All allocated slabs. */
+  QList<Block *> _slabs;
+};
+
+
 /* ******************************************************************************************** *
  * Implementation of ValueSearchQuery
  * ******************************************************************************************** */
@@ -233,13 +421,58 @@ RendezvousSearchQuery::next(NodeItem &node) {
   return false;
 }
 
+/* ******************************************************************************************** *
+ * Implementation of RequestPool
+ * ******************************************************************************************** */
+RequestPool::RequestPool()
+  : _free(0), _slabs()
+{
+  // pass...
+}
+
+RequestPool::~RequestPool() {
+  foreach (Block *slab, _slabs) {
+    delete[] slab;
+  }
+}
+
+void *
+RequestPool::alloc(size_t size) {
+  Q_ASSERT(size <= sizeof(Block));
+  if (0 == _free) {
+    // Allocate a new slab and link its blocks into the free list
+    Block *slab = new Block[NODE_REQUEST_SLAB_SIZE];
+    for (int i=0; i<(NODE_REQUEST_SLAB_SIZE-1); i++) {
+      slab[i].next = &slab[i+1];
+    }
+    slab[NODE_REQUEST_SLAB_SIZE-1].next = 0;
+    _slabs.append(slab);
+    _free = slab;
+  }
+  Block *block = _free;
+  _free = block->next;
+  return block;
+}
+
+void
+RequestPool::free(void *ptr) {
+  if (0 == ptr) { return; }
+  Block *block = reinterpret_cast<Block *>(ptr);
+  block->next = _free;
+  _free = block;
+}
+
+
 /* ******************************************************************************************** *
  * Implementation of Request etc.
  * ******************************************************************************************** */
 Request::Request(Type type)
-  : _type(type), _cookie(Identifier::create()), _timestamp(QDateTime::currentDateTime())
+  : _type(type), _sent(0), _deadline(0), _prev(0), _next(0)
 {
-  // pass...
+  // Random cookie
+  for (int i=0; i<OVL_COOKIE_SIZE; i++) {
+    _cookie[i] = qrand() % 0xff;
+  }
 }
 
 PingRequest::PingRequest(const Identifier &netid)
@@ -254,8 +487,8 @@ PingRequest::PingRequest(const Identifier &id, const Identifier &netid)
   // pass...
 }
 
-SearchRequest::SearchRequest(SearchQuery *query)
-  : Request(SEARCH), _query(query)
+SearchRequest::SearchRequest(SearchQuery *query, const Identifier &to)
+  : Request(SEARCH), _query(query), _to(to)
 {
   // pass...
 }
@@ -263,7 +496,7 @@ SearchRequest::SearchRequest(SearchQuery *query)
 StartConnectionRequest::StartConnectionRequest(const Identifier &service, const Identifier &peer, SecureSocket *socket)
   : Request(START_CONNECTION), _service(service), _peer(peer), _socket(socket)
 {
-  _cookie = socket->id();
+  memcpy(_cookie, socket->id().constData(), OVL_COOKIE_SIZE);
 }
 
 
@@ -272,31 +505,71 @@ StartConnectionRequest::StartConnectionRequest(const Identifier &service, const
  * ******************************************************************************************** */
 Node::Node(const Identity &id,
            const QHostAddress &addr, quint16 port, QObject *parent)
-  : Network(id.id(), parent), _self(id), _socket(), _started(false),
-    _prefix(""), _networks(),
+  : Network(id.id(), parent), _self(id), _transport(new UdpTransport(this)),
+    _rxBatch(), _started(false), _prefix(""), _networks(),
+    _bytesReceived(0), _lastBytesReceived(0), _inRate(0),
+    _bytesSend(0), _lastBytesSend(0), _outRate(0), _metrics(),
+    _cookies(), _clock(), _requestWheel(NODE_REQUEST_WHEEL_SIZE, 0), _wheelTick(0),
+    _txMessage(new Message()), _requestPool(new RequestPool()), _hostCache(), _pendingLookups(),
+    _searchCache(), _searchCacheOrder(), _destinations(),
+    _activeDestinations(), _queuedDatagrams(0), _pacingRate(NODE_PACING_RATE),
+    _pacingBurst(NODE_PACING_BURST), _sendTimer(), _requestTimer(), _rendezvousTimer(),
+    _statisticsTimer(), _snapshotFile(), _snapshotTimer(), _pingSweep(), _pingSweepTimer(),
+    _bootstrapStage(BOOTSTRAP_IDLE), _bootstrapSeeds(), _bootstrapStarted(0),
+    _bootstrapStageStarted(0), _timeToReady(-1), _bootstrapQueries(), _bootstrapTimer(),
+    _bootstrapDelayTimer()
+{
+  _init(addr, port);
+}
+
+Node::Node(const Identity &id, AbstractTransport *transport,
+           const QHostAddress &addr, quint16 port, QObject *parent)
+  : Network(id.id(), parent), _self(id), _transport(transport),
+    _rxBatch(), _started(false), _prefix(""), _networks(),
     _bytesReceived(0), _lastBytesReceived(0), _inRate(0),
-    _bytesSend(0), _lastBytesSend(0), _outRate(0),
-    _connections(), _requestTimer(), _rendezvousTimer(), _statisticsTimer()
+    _bytesSend(0), _lastBytesSend(0), _outRate(0), _metrics(),
+    _cookies(), _clock(), _requestWheel(NODE_REQUEST_WHEEL_SIZE, 0), _wheelTick(0),
+    _txMessage(new Message()), _requestPool(new RequestPool()), _hostCache(), _pendingLookups(),
+    _searchCache(), _searchCacheOrder(), _destinations(),
+    _activeDestinations(), _queuedDatagrams(0), _pacingRate(NODE_PACING_RATE),
+    _pacingBurst(NODE_PACING_BURST), _sendTimer(), _requestTimer(), _rendezvousTimer(),
+    _statisticsTimer(), _snapshotFile(), _snapshotTimer(), _pingSweep(), _pingSweepTimer(),
+    _bootstrapStage(BOOTSTRAP_IDLE), _bootstrapSeeds(), _bootstrapStarted(0),
+    _bootstrapStageStarted(0), _timeToReady(-1), _bootstrapQueries(), _bootstrapTimer(),
+    _bootstrapDelayTimer()
 {
+  // take ownership of transport
+  _transport->setParent(this);
+  _init(addr, port);
+}
+
+void
+Node::_init(const QHostAddress &addr, uint16_t port) {
   // seed RNG
   qsrand(QDateTime::currentDateTime().currentMSecsSinceEpoch());
 
-  logInfo() << "Start node #" << id.id() << " @ " << addr << ":" << port;
+  logInfo() << "Start node #" << _self.id() << " @ " << addr << ":" << port;
 
   // register myself as a network (root network)
   _networks.insert(this->netid(), this);
 
   // try to bind socket to address and port
-  if (! _socket.bind(addr, port)) {
+  if (! _transport->bind(addr, port)) {
     logError() << "Cannot bind to " << addr << ":" << port;
     return;
   }
+  // Allocate receive buffers
+  _rxBatch.resize(_transport->batchSize());
+
+  // Start monotonic clock for request deadlines
+  _clock.start();
+  // Advance the coarse clock of the routing tables once per event-loop iteration
+  Ticks::update();
+  if (QAbstractEventDispatcher::instance()) {
+    connect(QAbstractEventDispatcher::instance(), SIGNAL(awake()), this, SLOT(_onEventLoopAwake()));
+  }
 
-  // Connect to error slot
-  connect(&_socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
-          this,SLOT(_onSocketError(QAbstractSocket::SocketState)));
-
-  // check request timeouts every 500ms
+  // check request timeouts every 100ms
   _requestTimer.setInterval(NODE_REQUEST_CHECK_INTERVAL);
   _requestTimer.setSingleShot(false);
 
@@ -308,12 +581,35 @@ Node::Node(const Identity &id,
   _rendezvousTimer.setInterval(NODE_RENDEZVOUS_PING_INTERVAL);
   _rendezvousTimer.setSingleShot(false);
 
+  // Send queued datagrams at the pacing interval
+  _sendTimer.setInterval(NODE_PACING_INTERVAL);
+  _sendTimer.setSingleShot(true);
+
+  // Save snapshots every 5 minutes, once enabled
+  _snapshotTimer.setInterval(NODE_SNAPSHOT_INTERVAL);
+  _snapshotTimer.setSingleShot(false);
+
+  // Ping nodes loaded from a snapshot in batches
+  _pingSweepTimer.setInterval(NODE_PING_SWEEP_INTERVAL);
+  _pingSweepTimer.setSingleShot(false);
+
+  // Timeout of the stages of the join and the delay of the self-lookups
+  _bootstrapTimer.setInterval(NODE_BOOTSTRAP_TIMEOUT);
+  _bootstrapTimer.setSingleShot(true);
+  _bootstrapDelayTimer.setInterval(NODE_BOOTSTRAP_DELAY);
+  _bootstrapDelayTimer.setSingleShot(true);
+
   // Check for dead announcements and check for update my announcement items every 3min
-  connect(&_socket, SIGNAL(readyRead()), this, SLOT(_onReadyRead()));
-  connect(&_socket, SIGNAL(bytesWritten(qint64)), this, SLOT(_onBytesWritten(qint64)));
+  connect(_transport, SIGNAL(readyRead()), this, SLOT(_onReadyRead()));
+  connect(_transport, SIGNAL(bytesWritten(qint64)), this, SLOT(_onBytesWritten(qint64)));
   connect(&_requestTimer, SIGNAL(timeout()), this, SLOT(_onCheckRequestTimeout()));
   connect(&_rendezvousTimer, SIGNAL(timeout()), this, SLOT(_onPingRendezvousNodes()));
   connect(&_statisticsTimer, SIGNAL(timeout()), this, SLOT(_onUpdateStatistics()));
+  connect(&_sendTimer, SIGNAL(timeout()), this, SLOT(_onDrainSendQueue()));
+  connect(&_snapshotTimer, SIGNAL(timeout()), this, SLOT(_onSaveSnapshot()));
+  connect(&_pingSweepTimer, SIGNAL(timeout()), this, SLOT(_onPingSweep()));
+  connect(&_bootstrapTimer, SIGNAL(timeout()), this, SLOT(_onBootstrapTimeout()));
+  connect(&_bootstrapDelayTimer, SIGNAL(timeout()), this, SLOT(_onBootstrapLookups()));
 
   _requestTimer.start();
   _statisticsTimer.start();
@@ -322,15 +618,22 @@ Node::Node(const Identity &id,
 }
 
 Node::~Node() {
-  // pass...
+  if (! _snapshotFile.isEmpty()) {
+    saveSnapshot(_snapshotFile);
+  }
+  delete _txMessage;
+  // Pending requests are released with their slabs
+  delete _requestPool;
 }
 
 bool
 Node::hasNetwork(const QString &prefix) const {
-  char hash[OVL_HASH_SIZE];
-  QByteArray prefName = prefix.toUtf8();
-  OVLHash((const uint8_t *)prefName.constData(), prefName.size(), (uint8_t *)hash);
-  return _networks.contains(Identifier(hash));
+  return hasNetwork(Identifier::fromName(prefix));
+}
+
+bool
+Node::hasNetwork(const Identifier &netid) const {
+  return _networks.contains(netid);
 }
 
 bool
@@ -344,18 +647,41 @@ Node::registerNetwork(Network *subnet) {
 
 Network *
 Node::network(const QString &prefix) {
-  char hash[OVL_HASH_SIZE];
-  QByteArray prefName = prefix.toUtf8();
-  OVLHash((const uint8_t *)prefName.constData(), prefName.size(), (uint8_t *)hash);
-  return _networks[Identifier(hash)];
+  return network(Identifier::fromName(prefix));
+}
+
+Network *
+Node::network(const Identifier &netid) {
+  return _networks.value(netid, 0);
 }
 
 void
 Node::ping(const QString &addr, uint16_t port) {
-  QHostInfo info = QHostInfo::fromName(addr);
-  foreach (QHostAddress addr, info.addresses()) {
-    ping(addr, port);
+  // Ping literal addresses directly
+  QHostAddress literal;
+  if (literal.setAddress(addr)) {
+    ping(literal, port);
+    return;
   }
+  // Ping cached addresses
+  QHash<QString, HostCacheEntry>::iterator entry = _hostCache.find(addr);
+  if (entry != _hostCache.end()) {
+    if (entry->expires > _clock.elapsed()) {
+      foreach (QHostAddress host, entry->addresses) {
+        ping(host, port);
+      }
+      return;
+    }
+    _hostCache.erase(entry);
+  }
+  // If a lookup for the host is pending -> ping once resolved
+  if (_pendingLookups.contains(addr)) {
+    _pendingLookups[addr].append(port);
+    return;
+  }
+  // Otherwise, start lookup. Lookups run concurrently in the Qt host lookup threads
+  _pendingLookups[addr].append(port);
+  QHostInfo::lookupHost(addr, this, SLOT(_onHostResolved(QHostInfo)));
 }
 
 void
@@ -378,18 +704,61 @@ Node::ping(const NodeItem &node) {
   sendPing(node.id(), node.addr(), node.port(), netid());
 }
 
+void
+Node::bootstrap(const QList<QPair<QString, uint16_t> > &seeds) {
+  // If a join is running, just contact the additional seeds
+  bool running = joining();
+  for (int i=0; i<seeds.size(); i++) {
+    ping(seeds[i].first, seeds[i].second);
+  }
+  if (running) {
+    _bootstrapSeeds.append(seeds);
+    return;
+  }
+
+  logInfo() << "Bootstrap: Contact " << seeds.size() << " seeds and "
+            << std::min(NODE_BOOTSTRAP_PEERS, _pingSweep.size()) << " cached nodes.";
+  _bootstrapStage = BOOTSTRAP_CONTACT;
+  _bootstrapSeeds = seeds;
+  _bootstrapStarted = _bootstrapStageStarted = _clock.elapsed();
+  _timeToReady = -1;
+  _bootstrapQueries.clear();
+  // Ping the most recently seen nodes of the snapshot at once, the remaining ones are swept
+  _sweep(NODE_BOOTSTRAP_PEERS);
+  _bootstrapTimer.start();
+  // If there are confirmed nodes already -> start lookups
+  QList<NodeItem> nodes;
+  _buckets.getNearest(_self.id(), nodes);
+  if (nodes.size()) {
+    _bootstrapDelayTimer.start();
+  }
+}
+
+bool
+Node::isReady() const {
+  return BOOTSTRAP_READY == _bootstrapStage;
+}
+
+qint64
+Node::timeToReady() const {
+  return _timeToReady;
+}
+
 void
 Node::search(SearchQuery *query) {
   query->ignore(_self.id());
   // Collect DHT_K nearest nodes
-  _buckets.getNearest(query->id(), query->best());
-  // Send request to the first element in the list
-  NodeItem next;
-  if (! query->next(next)) {
+  QList<NodeItem> nodes;
+  _buckets.getNearest(query->id(), nodes);
+  foreach (const NodeItem &item, nodes) {
+    query->update(item, rtt(item.id()));
+  }
+  // Send requests to the first elements in the list
+  if (0 == query->best().size()) {
     logInfo() << "Can not search for " << query->id() << ". Buckets empty.";
     query->searchFailed();
   } else {
-    sendSearch(next, query);
+    continueSearch(query);
   }
 }
 
@@ -399,32 +768,29 @@ Node::rendezvous(const Identifier &id) {
   SearchQuery *query = new RendezvousSearchQuery(*this, id);
   query->ignore(_self.id());
   // Collect DHT_K nearest nodes
-  _buckets.getNearest(id, query->best());
-  // Send request to the first element in the list
-  NodeItem next;
-  if (! query->next(next)) {
+  QList<NodeItem> nodes;
+  _buckets.getNearest(id, nodes);
+  foreach (const NodeItem &item, nodes) {
+    query->update(item, rtt(item.id()));
+  }
+  // Send requests to the first elements in the list
+  if (0 == query->best().size()) {
     logInfo() << "Can not find node" << id << ". Buckets empty.";
     query->searchCompleted();
   } else {
-    sendSearch(next, query);
+    continueSearch(query);
   }
 }
 
 bool
 Node::hasService(const QString &service) const {
-  unsigned char hash[OVL_HASH_SIZE];
-  QByteArray service_name = service.toUtf8();
-  OVLHash((const unsigned char *)service_name.data(), service_name.size(), hash);
-  return _services.contains(Identifier((char *)hash));
+  return _services.contains(Identifier::fromName(service));
 }
 
 bool
 Node::registerService(const QString &service, AbstractService *handler) {
   logInfo() << "Register service " << service << ".";
-  unsigned char hash[OVL_HASH_SIZE];
-  QByteArray sName = service.toUtf8();
-  OVLHash((const uint8_t *)sName.constData(), sName.size(), hash);
-  Identifier id((const char *) hash);
+  Identifier id = Identifier::fromName(service);
   if (_services.contains(id))
     return false;
   _services.insert(id, handler);
@@ -432,29 +798,31 @@ Node::registerService(const QString &service, AbstractService *handler) {
 }
 
 bool
-Node::startConnection(const QString &service, const NodeItem &node, SecureSocket *stream)
+Node::startConnection(const QString &service, const NodeItem &node, SecureSocket *stream) {
+  return startConnection(Identifier::fromName(service), node, stream);
+}
+
+bool
+Node::startConnection(const Identifier &service, const NodeItem &node, SecureSocket *stream)
 {
   logDebug() << "Send start secure connection id=" << stream->id()
              << " to " << node.id()
              << " @" << node.addr() << ":" << node.port();
 
-  uint8_t serviceId[OVL_HASH_SIZE];
-  QByteArray sName = service.toUtf8();
-  OVLHash((const uint8_t *)sName.constData(), sName.size(), serviceId);
-
-  StartConnectionRequest *req = new StartConnectionRequest(Identifier((const char *)serviceId), node.id(), stream);
+  StartConnectionRequest *req = new (_requestPool->alloc(sizeof(StartConnectionRequest)))
+      StartConnectionRequest(service, node.id(), stream);
 
   // Assemble message
-  Message msg;
-  memcpy(msg.cookie, req->cookie().data(), OVL_COOKIE_SIZE);
+  Message &msg = *_txMessage;
+  memcpy(msg.cookie, req->cookie(), OVL_COOKIE_SIZE);
   msg.payload.start_connection.type = Message::CONNECT;
   // Store service ID in package
-  memcpy(msg.payload.start_connection.service, serviceId, OVL_HASH_SIZE);
+  memcpy(msg.payload.start_connection.service, service.constData(), OVL_HASH_SIZE);
 
   int keyLen = 0;
   if (0 > (keyLen = stream->prepare(msg.payload.start_connection.pubkey, OVL_MAX_PUBKEY_SIZE)) ) {
     stream->failed();
-    delete req;
+    _freeRequest(req);
     return false;
   }
 
@@ -462,14 +830,15 @@ Node::startConnection(const QString &service, const NodeItem &node, SecureSocket
   keyLen += OVL_COOKIE_SIZE + 1 + OVL_HASH_SIZE;
 
   // add to pending request list & send it
-  _pendingRequests.insert(req->cookie(), req);
-  if (keyLen != _socket.writeDatagram((char *)&msg, keyLen, node.addr(), node.port())) {
+  _addPendingRequest(req, node.id());
+  if (! _transport->send((const uint8_t *)&msg, keyLen, node.addr(), node.port())) {
     // one error remove from list of pending request and free connection & request
-    _pendingRequests.remove(req->cookie());
+    _removePendingRequest(req);
     stream->failed();
-    delete req;
+    _freeRequest(req);
     return false;
   }
+  _metrics.countOut(NodeMetrics::CONNECT);
 
   return true;
 }
@@ -477,7 +846,7 @@ Node::startConnection(const QString &service, const NodeItem &node, SecureSocket
 void
 Node::socketClosed(const Identifier &id) {
   logDebug() << "Secure socket " << id << " closed.";
-  _connections.remove(id);
+  _cookies.remove(id.constData(), CookieTable::STREAM);
 }
 
 Identity &
@@ -508,8 +877,18 @@ Node::prefix() const {
 bool
 Node::started() const {
   // Check if socket is bound
-  return (_started && _socket.isValid() &&
-          (QAbstractSocket::BoundState == _socket.state()));
+  return (_started && _transport->isBound());
+}
+
+AbstractTransport &
+Node::transport() {
+  return *_transport;
+}
+
+void
+Node::setBatchSize(size_t n) {
+  _transport->setBatchSize(n);
+  _rxBatch.resize(_transport->batchSize());
 }
 
 size_t
@@ -522,9 +901,162 @@ Node::nodes(QList<NodeItem> &lst) {
   _buckets.nodes(lst);
 }
 
+size_t
+Node::numBuckets() const {
+  return _buckets.numBuckets();
+}
+
+size_t
+Node::numPendingRequests() const {
+  return _cookies.count(CookieTable::REQUEST);
+}
+
+int
+Node::rtt(const Identifier &id) const {
+  int srtt, rttvar;
+  if (! _rtt(id, srtt, rttvar)) { return -1; }
+  return srtt;
+}
+
+int
+Node::rttVariance(const Identifier &id) const {
+  int srtt, rttvar;
+  if (! _rtt(id, srtt, rttvar)) { return -1; }
+  return rttvar;
+}
+
+int
+Node::requestTimeout(const Identifier &id) const {
+  int srtt, rttvar;
+  if ((! id.isValid()) || (! _rtt(id, srtt, rttvar))) {
+    return NODE_REQUEST_TIMEOUT;
+  }
+  // RTO = SRTT + max(G, 4*RTTVAR), where G is the granularity of the timing wheel (RFC 6298)
+  int timeout = srtt + std::max(NODE_REQUEST_CHECK_INTERVAL, 4*rttvar);
+  return std::max(NODE_REQUEST_MIN_TIMEOUT, std::min(timeout, NODE_REQUEST_MAX_TIMEOUT));
+}
+
+bool
+Node::saveSnapshot(const QString &filename) const {
+  // Collect confirmed nodes of all networks
+  QVector<SnapshotEntry> entries;
+  uint32_t now = Ticks::now();
+  QHash<Identifier, Network *>::const_iterator network = _networks.begin();
+  for (; network != _networks.end(); network++) {
+    QList<Bucket::Item> items;
+    (*network)->_buckets.items(items);
+    foreach (const Bucket::Item &item, items) {
+      if (! item.isValid()) { continue; }
+      SnapshotEntry entry;
+      memcpy(entry.network, network.key().constData(), OVL_HASH_SIZE);
+      memcpy(entry.id, item.id().constData(), OVL_HASH_SIZE);
+      memcpy(entry.ip, item.peer().ip(), 16);
+      entry.port   = item.port();
+      entry.age    = now - item.lastSeen();
+      entry.srtt   = item.rtt();
+      entry.rttvar = item.rttVar();
+      entries.append(entry);
+    }
+  }
+  // Store most recently seen nodes first
+  std::sort(entries.begin(), entries.end(), snapshotEntryLessThan);
+
+  QSaveFile file(filename);
+  if (! file.open(QIODevice::WriteOnly)) {
+    logError() << "Cannot save snapshot to " << filename << ": " << file.errorString();
+    return false;
+  }
+  SnapshotHeader header;
+  memcpy(header.magic, "OVLS", 4);
+  header.version  = qToBigEndian(quint16(NODE_SNAPSHOT_VERSION));
+  header.reserved = 0;
+  header.saved    = qToBigEndian(quint64(QDateTime::currentMSecsSinceEpoch()/1000));
+  header.count    = qToBigEndian(quint32(entries.size()));
+  file.write((const char *)&header, sizeof(SnapshotHeader));
+  QVector<SnapshotEntry>::iterator entry = entries.begin();
+  for (; entry != entries.end(); entry++) {
+    entry->port   = qToBigEndian(entry->port);
+    entry->age    = qToBigEndian(entry->age);
+    entry->srtt   = qToBigEndian(entry->srtt);
+    entry->rttvar = qToBigEndian(entry->rttvar);
+  }
+  file.write((const char *)entries.constData(), entries.size()*sizeof(SnapshotEntry));
+  if (! file.commit()) {
+    logError() << "Cannot save snapshot to " << filename << ": " << file.errorString();
+    return false;
+  }
+  logDebug() << "Saved " << entries.size() << " nodes to " << filename << ".";
+  return true;
+}
+
+int
+Node::loadSnapshot(const QString &filename) {
+  QFile file(filename);
+  if (! file.open(QIODevice::ReadOnly)) {
+    logError() << "Cannot load snapshot from " << filename << ": " << file.errorString();
+    return -1;
+  }
+  SnapshotHeader header;
+  if ((sizeof(SnapshotHeader) != file.read((char *)&header, sizeof(SnapshotHeader))) ||
+      (0 != memcmp(header.magic, "OVLS", 4)) ||
+      (NODE_SNAPSHOT_VERSION != qFromBigEndian(header.version)))
+  {
+    logError() << "Cannot load snapshot from " << filename << ": Invalid header.";
+    return -1;
+  }
+  // Account for the time the node was down
+  qint64 down = QDateTime::currentMSecsSinceEpoch()/1000 - qint64(qFromBigEndian(quint64(header.saved)));
+  down = std::max(qint64(0), down);
+
+  // Stream entries, add them as candidates in order (most recently seen first)
+  int count = 0;
+  uint32_t n = qFromBigEndian(header.count);
+  SnapshotEntry entry;
+  for (uint32_t i=0; i<n; i++) {
+    if (sizeof(SnapshotEntry) != file.read((char *)&entry, sizeof(SnapshotEntry))) {
+      logWarning() << "Snapshot " << filename << " truncated.";
+      break;
+    }
+    if ((down + qFromBigEndian(entry.age)) > NODE_SNAPSHOT_MAX_AGE) { continue; }
+    Identifier netid(entry.network);
+    Network *network = _networks.value(netid, 0);
+    if (0 == network) { continue; }
+    NodeItem node(Identifier(entry.id), PeerItem(entry.ip, qFromBigEndian(entry.port)));
+    if ((node.id() == _self.id()) || network->_buckets.contains(node.id())) { continue; }
+    network->addCandidate(node);
+    if (0 <= qint32(qFromBigEndian(entry.srtt))) {
+      network->_buckets.setRtt(node.id(), qFromBigEndian(entry.srtt), qFromBigEndian(entry.rttvar));
+    }
+    _pingSweep.append(QPair<Identifier, NodeItem>(netid, node));
+    count++;
+  }
+  logInfo() << "Loaded " << count << " nodes from snapshot " << filename << ".";
+
+  // Validate candidates
+  if (_pingSweep.size() && (! _pingSweepTimer.isActive())) {
+    _pingSweepTimer.start();
+  }
+  return count;
+}
+
+void
+Node::setSnapshotFile(const QString &filename) {
+  _snapshotFile = filename;
+  if (_snapshotFile.isEmpty()) {
+    _snapshotTimer.stop();
+  } else {
+    _snapshotTimer.start();
+  }
+}
+
 size_t
 Node::numSockets() const {
-  return _connections.size();
+  return _cookies.count(CookieTable::STREAM);
+}
+
+size_t
+Node::numServices() const {
+  return _services.size();
 }
 
 size_t
@@ -547,6 +1079,11 @@ Node::outRate() const {
   return _outRate;
 }
 
+const NodeMetrics &
+Node::metrics() const {
+  return _metrics;
+}
+
 bool
 Node::rendezvousPingEnabled() const {
   return _rendezvousTimer.isActive();
@@ -568,17 +1105,15 @@ void
 Node::sendPing(const QHostAddress &addr, uint16_t port, const Identifier &netid) {
   //logDebug() << "Send ping to " << addr << ":" << port << " within net " << netid << ".";
   // Create named ping request
-  PingRequest *req = new PingRequest(netid);
-  _pendingRequests.insert(req->cookie(), req);
+  PingRequest *req = new (_requestPool->alloc(sizeof(PingRequest))) PingRequest(netid);
+  _addPendingRequest(req, Identifier());
   // Assemble message
-  Message msg;
-  memcpy(msg.cookie, req->cookie().data(), OVL_COOKIE_SIZE);
-  memcpy(msg.payload.ping.id, _self.id().constData(), OVL_HASH_SIZE);
-  memcpy(msg.payload.ping.network, netid.constData(), OVL_HASH_SIZE);
-  msg.payload.ping.type = Message::PING;
+  size_t size = _txMessage->assemblePing(req->cookie(), _self.id(), netid);
   // send it
-  if(0 > _socket.writeDatagram((char *) &msg, OVL_PING_REQU_SIZE, addr, port)) {
+  if (! _transport->send((const uint8_t *) _txMessage, size, addr, port)) {
     logError() << "Failed to send ping to " << addr << ":" << port;
+  } else {
+    _metrics.countOut(NodeMetrics::PING);
   }
 }
 
@@ -586,148 +1121,533 @@ void
 Node::sendPing(const Identifier &id, const QHostAddress &addr, uint16_t port, const Identifier &netid) {
   //logDebug() << "Send ping to " << addr << ":" << port << " within net " << netid << ".";
   // Create named ping request
-  PingRequest *req = new PingRequest(id, netid);
-  _pendingRequests.insert(req->cookie(), req);
+  PingRequest *req = new (_requestPool->alloc(sizeof(PingRequest))) PingRequest(id, netid);
+  _addPendingRequest(req, id);
   // Assemble message
-  Message msg;
-  memcpy(msg.cookie, req->cookie().data(), OVL_COOKIE_SIZE);
-  memcpy(msg.payload.ping.id, _self.id().constData(), OVL_HASH_SIZE);
-  memcpy(msg.payload.ping.network, netid.constData(), OVL_HASH_SIZE);
-  msg.payload.ping.type = Message::PING;
+  size_t size = _txMessage->assemblePing(req->cookie(), _self.id(), netid);
   // send it
-  if(0 > _socket.writeDatagram((char *) &msg, OVL_PING_REQU_SIZE, addr, port)) {
+  if (! _transport->send((const uint8_t *) _txMessage, size, addr, port)) {
     logError() << "Failed to send ping to " << addr << ":" << port;
+  } else {
+    _metrics.countOut(NodeMetrics::PING);
   }
 }
 
 void
 Node::sendSearch(const NodeItem &to, SearchQuery *query) {
   // Construct request item
-  SearchRequest *req = new SearchRequest(query);
+  SearchRequest *req = new (_requestPool->alloc(sizeof(SearchRequest)))
+      SearchRequest(query, to.id());
   // Queue request
-  _pendingRequests.insert(req->cookie(), req);
+  _addPendingRequest(req, to.id());
+  query->requestSent();
   // Assemble & send message
-  Message msg;
-  memcpy(msg.cookie, req->cookie().data(), OVL_COOKIE_SIZE);
-  msg.payload.search.type = Message::SEARCH;
-  memcpy(msg.payload.search.id, query->id().constData(), OVL_HASH_SIZE);
-  memcpy(msg.payload.search.network, query->netid().constData(), OVL_HASH_SIZE);
-  int size = OVL_COOKIE_SIZE+1+OVL_HASH_SIZE+OVL_K*OVL_TRIPLE_SIZE;
-  if (size != _socket.writeDatagram((char *)&msg, size, to.addr(), to.port())) {
+  size_t size = _txMessage->assembleSearch(req->cookie(), query->id(), query->netid(), OVL_K);
+  if (! _transport->send((const uint8_t *)_txMessage, size, to.addr(), to.port())) {
     logError() << "Failed to send Search request to " << to.id()
                << " @" << to.addr() << ":" << to.port();
+  } else {
+    _metrics.countOut(NodeMetrics::SEARCH);
+  }
+}
+
+void
+Node::continueSearch(SearchQuery *query) {
+  NodeItem next;
+  while ((query->inflight() < query->alpha()) && query->next(next)) {
+    sendSearch(next, query);
+  }
+  // If there is nothing left to wait for -> search completed
+  if (0 == query->inflight()) {
+    query->searchCompleted();
   }
 }
 
 void
 Node::sendRendezvous(const Identifier &with, const PeerItem &to) {
-  Message msg;
-  memcpy(msg.cookie, Identifier::create().data(), OVL_COOKIE_SIZE);
-  memcpy(msg.payload.rendezvous.id, with.data(), OVL_HASH_SIZE);
-  if (OVL_RENDEZVOUS_REQU_SIZE != _socket.writeDatagram(
-        (char *)&msg, OVL_RENDEZVOUS_REQU_SIZE, to.addr(), to.port())) {
+  char cookie[OVL_COOKIE_SIZE];
+  for (int i=0; i<OVL_COOKIE_SIZE; i++) { cookie[i] = qrand() % 0xff; }
+  size_t size = _txMessage->assembleRendezvous(cookie, with);
+  if (! _transport->send((const uint8_t *)_txMessage, size, to.addr(), to.port())) {
     logError() << "DHT: Failed to send Rendezvous request to " << to.addr() << ":" << to.port();
+  } else {
+    _metrics.countOut(NodeMetrics::RENDEZVOUS);
   }
 }
 
 bool
-Node::sendData(const Identifier &id, const uint8_t *data, size_t len, const PeerItem &peer) {
-  return sendData(id, data, len, peer.addr(), peer.port());
+Node::sendData(const Identifier &id, const uint8_t *data, size_t len, const QHostAddress &addr, uint16_t port) {
+  return sendData(id, data, len, PeerItem(addr, port));
 }
 
 bool
-Node::sendData(const Identifier &id, const uint8_t *data, size_t len, const QHostAddress &addr, uint16_t port) {
+Node::sendData(const Identifier &id, const uint8_t *data, size_t len, const PeerItem &peer) {
   if (len > OVL_MAX_DATA_SIZE) {
     logError() << "DHT: sendData(): Cannot send connection data: payload too large "
                << len << ">" << OVL_MAX_DATA_SIZE << "!";
     return false;
   }
   // Assemble message
-  Message msg;
-  memcpy(msg.cookie, id.constData(), OVL_COOKIE_SIZE);
-  memcpy(msg.payload.datagram, data, len);
-  // send it
-  return (qint64(len+OVL_COOKIE_SIZE) ==
-          _socket.writeDatagram((const char *)&msg, (len+OVL_COOKIE_SIZE), addr, port));
+  size_t size = _txMessage->assembleData(id.constData(), data, len);
+  // send or queue it
+  if (! _sendPaced(id, (const uint8_t *)_txMessage, size, peer)) {
+    return false;
+  }
+  _metrics.countOut(NodeMetrics::DATA);
+  return true;
+}
+
+void
+Node::setPacingRate(size_t rate, size_t burst) {
+  _pacingRate = rate;
+  _pacingBurst = std::max(burst, size_t(OVL_MAX_MESSAGE_SIZE));
+}
+
+size_t
+Node::queuedDatagrams() const {
+  return _queuedDatagrams;
+}
+
+bool
+Node::sendQueueCongested(const PeerItem &peer) const {
+  QHash<PeerItem, Destination>::const_iterator dest = _destinations.find(peer);
+  return (dest != _destinations.end()) && dest->congested;
+}
+
+void
+Node::notifyWhenDrained(const Identifier &id, const PeerItem &peer) {
+  QHash<PeerItem, Destination>::iterator dest = _destinations.find(peer);
+  if ((dest == _destinations.end()) || (! dest->congested)) { return; }
+  if (! dest->blocked.contains(id)) { dest->blocked.append(id); }
+}
+
+bool
+Node::_sendPaced(const Identifier &id, const uint8_t *data, size_t len, const PeerItem &peer) {
+  Destination &dest = _destinations[peer];
+  // Refill token bucket
+  qint64 now = _clock.elapsed();
+  if ((0 > dest.tokens) || (0 == _pacingRate)) {
+    dest.tokens = _pacingBurst;
+  } else {
+    dest.tokens = std::min(double(_pacingBurst),
+                           dest.tokens + double(_pacingRate)*(now-dest.lastRefill)/1000);
+  }
+  dest.lastRefill = now;
+
+  // If nothing is queued and the budget allows -> send immediately
+  if (dest.queue.isEmpty() && (dest.tokens >= len)) {
+    if (_transport->send(data, len, peer.addr(), peer.port())) {
+      dest.tokens -= len;
+      return true;
+    }
+  }
+
+  // Otherwise queue datagram, unless the queue is full
+  if (dest.queue.size() >= NODE_SEND_QUEUE_SIZE) {
+    dest.congested = true;
+    if (! dest.blocked.contains(id)) { dest.blocked.append(id); }
+    return false;
+  }
+  if (dest.queue.isEmpty()) {
+    _activeDestinations.append(peer);
+  }
+  dest.queue.append(QByteArray((const char *)data, len));
+  _queuedDatagrams++;
+  if (dest.queue.size() >= NODE_SEND_QUEUE_SIZE) {
+    dest.congested = true;
+  }
+  if (! _sendTimer.isActive()) {
+    _sendTimer.start(NODE_PACING_INTERVAL);
+  }
+  return true;
 }
 
 void
 Node::_onReadyRead() {
-  while (_socket.hasPendingDatagrams()) {
-    // check datagram size
-    if ( (_socket.pendingDatagramSize() > OVL_MAX_MESSAGE_SIZE) ||
-         (_socket.pendingDatagramSize() < OVL_MIN_MESSAGE_SIZE)) {
-      QHostAddress addr; uint16_t port;
-      // Cannot be a vaild message -> drop it
-      _socket.readDatagram(0, 0, &addr, &port);
-      logInfo() << "Invalid UDP packet received from " << addr << ":" << port;
-    } else {
-      // Update RX statistics
-      _bytesReceived += _socket.pendingDatagramSize();
-      // Read message
-      struct Message msg; QHostAddress addr; uint16_t port;
-      int64_t size = _socket.readDatagram((char *) &msg, sizeof(Message), &addr, &port);
-      // Extract cookie
-      Identifier cookie(msg.cookie);
-
-      // First, check if message belongs to a open stream
-      if (_connections.contains(cookie)) {
-        // Process streams
-        _connections[cookie]->handleData(((uint8_t *)&msg)+OVL_COOKIE_SIZE, size-OVL_COOKIE_SIZE);
-      } else if (_pendingRequests.contains(cookie)) {
-        // Message is a response -> dispatch by type from table
-        Request *item = _pendingRequests[cookie];
-        // remove from pending requests
-        _pendingRequests.remove(cookie);
-        if (Request::PING == item->type()) {
-          _processPingResponse(msg, size, static_cast<PingRequest *>(item), addr, port);
-        } else if (Request::SEARCH == item->type()) {
-          _processSearchResponse(msg, size, static_cast<SearchRequest *>(item), addr, port);
-        } else if (Request::START_CONNECTION == item->type()) {
-          _processStartConnectionResponse(msg, size, static_cast<StartConnectionRequest *>(item), addr, port);
-        }else {
-          logInfo() << "Unknown response from " << addr << ":" << port;
-        }
-        delete item;
-      } else {
-        // Message is likely a request
-        if ((size == OVL_PING_REQU_SIZE) && (Message::PING == msg.payload.ping.type)){
-          _processPingRequest(msg, size, addr, port);
-        } else if ((size >= OVL_SEARCH_MIN_REQU_SIZE) && (Message::SEARCH == msg.payload.search.type)) {
-          _processSearchRequest(msg, size, addr, port);
-        } else if ((size > OVL_CONNECT_MIN_REQU_SIZE) && (Message::CONNECT == msg.payload.start_connection.type)) {
-          _processStartConnectionRequest(msg, size, addr, port);
-        } else if ((size == OVL_RENDEZVOUS_REQU_SIZE) && (Message::RENDEZVOUS == msg.payload.rendezvous.type)) {
-          _processRendezvousRequest(msg, size, addr, port);
-        } else {
-          logInfo() << "Unknown request from " << addr << ":" << port
-                    << " dropping " << (size-OVL_COOKIE_SIZE) << "b payload.";
-        }
+  size_t n = 0;
+  // Receive datagrams in batches until the socket is drained
+  // Follow changes of the batch size of the transport
+  if (size_t(_rxBatch.size()) != _transport->batchSize()) {
+    _rxBatch.resize(_transport->batchSize());
+  }
+  while (0 < (n = _transport->receive(_rxBatch.data(), _rxBatch.size()))) {
+    for (size_t i=0; i<n; i++) {
+      AbstractTransport::Datagram &dgram = _rxBatch[i];
+      // check datagram size
+      if ((dgram.size > OVL_MAX_MESSAGE_SIZE) || (dgram.size < OVL_MIN_MESSAGE_SIZE)) {
+        // Cannot be a vaild message -> drop it
+        logInfo() << "Invalid UDP packet received from " << dgram.addr << ":" << dgram.port;
+        _metrics.countDrop(NodeMetrics::DROP_SIZE);
+        continue;
       }
+      // Update RX statistics
+      _bytesReceived += dgram.size;
+      // Process message
+      _processDatagram(*reinterpret_cast<Message *>(dgram.data), dgram.size, dgram.addr, dgram.port);
+    }
+  }
+}
+
+void
+Node::_processDatagram(Message &msg, size_t size, const QHostAddress &addr, uint16_t port) {
+  // Measure the time spent processing the message
+  qint64 start = _clock.nsecsElapsed();
+  NodeMetrics::Type type = NodeMetrics::NUM_TYPES;
+
+  // Lookup cookie
+  const CookieTable::Entry *entry = _cookies.find(msg.cookie);
+
+  // First, check if message belongs to a open stream
+  if (entry && (CookieTable::STREAM == entry->type)) {
+    // Process streams
+    type = NodeMetrics::DATA;
+    SecureSocket *stream = entry->stream();
+    // The stream may get deleted by a slot connected to one of the signals emitted while the
+    // data is handled, hence the peer is obtained before
+    Identifier peer = stream->peerId();
+    if (stream->handleData(((uint8_t *)&msg)+OVL_COOKIE_SIZE, size-OVL_COOKIE_SIZE)) {
+      // Authenticated stream data proves the liveness of the peer
+      _touch(peer, PeerItem(addr, port));
     }
+  } else if (entry && (CookieTable::REQUEST == entry->type)) {
+    // Message is a response -> dispatch by type from table
+    Request *item = entry->request();
+    // remove from pending requests
+    _removePendingRequest(item);
+    if (Request::PING == item->type()) {
+      type = NodeMetrics::PING;
+      _processPingResponse(msg, size, static_cast<PingRequest *>(item), addr, port);
+    } else if (Request::SEARCH == item->type()) {
+      type = NodeMetrics::SEARCH;
+      _processSearchResponse(msg, size, static_cast<SearchRequest *>(item), addr, port);
+    } else if (Request::START_CONNECTION == item->type()) {
+      type = NodeMetrics::CONNECT;
+      _processStartConnectionResponse(msg, size, static_cast<StartConnectionRequest *>(item), addr, port);
+    }else {
+      logInfo() << "Unknown response from " << addr << ":" << port;
+      _metrics.countDrop(NodeMetrics::DROP_MALFORMED);
+    }
+    _freeRequest(item);
+  } else {
+    // Message is likely a request
+    if ((size == OVL_PING_REQU_SIZE) && (Message::PING == msg.payload.ping.type)){
+      type = NodeMetrics::PING;
+      _processPingRequest(msg, size, addr, port);
+    } else if ((size >= OVL_SEARCH_MIN_REQU_SIZE) && (Message::SEARCH == msg.payload.search.type)) {
+      type = NodeMetrics::SEARCH;
+      _processSearchRequest(msg, size, addr, port);
+    } else if ((size > OVL_CONNECT_MIN_REQU_SIZE) && (Message::CONNECT == msg.payload.start_connection.type)) {
+      type = NodeMetrics::CONNECT;
+      _processStartConnectionRequest(msg, size, addr, port);
+    } else if ((size == OVL_RENDEZVOUS_REQU_SIZE) && (Message::RENDEZVOUS == msg.payload.rendezvous.type)) {
+      type = NodeMetrics::RENDEZVOUS;
+      _processRendezvousRequest(msg, size, addr, port);
+    } else {
+      logInfo() << "Unknown request from " << addr << ":" << port
+                << " dropping " << (size-OVL_COOKIE_SIZE) << "b payload.";
+      _metrics.countDrop(NodeMetrics::DROP_UNKNOWN_COOKIE);
+    }
+  }
+
+  if (NodeMetrics::NUM_TYPES != type) {
+    _metrics.countIn(type);
+    _metrics.handlerTime(type).record((_clock.nsecsElapsed()-start)/1000);
   }
 }
 
 void
 Node::_onBytesWritten(qint64 n) {
   _bytesSend += n;
+  // The transport made progress -> continue sending queued datagrams
+  if (_queuedDatagrams && (! _sendTimer.isActive())) {
+    _sendTimer.start(0);
+  }
+}
+
+void
+Node::_onSaveSnapshot() {
+  if (! _snapshotFile.isEmpty()) {
+    saveSnapshot(_snapshotFile);
+  }
+}
+
+void
+Node::_onPingSweep() {
+  _sweep(NODE_PING_SWEEP_BATCH);
+}
+
+void
+Node::_sweep(int count) {
+  for (int i=0; (i<count) && (! _pingSweep.isEmpty()); i++) {
+    QPair<Identifier, NodeItem> item = _pingSweep.takeFirst();
+    // The network may have been removed meanwhile
+    Network *network = _networks.value(item.first, 0);
+    if (network) {
+      network->ping(item.second);
+    }
+  }
+  if (_pingSweep.isEmpty()) {
+    _pingSweepTimer.stop();
+  }
 }
 
 void
-Node::_onSocketError(QAbstractSocket::SocketState error) {
-  logError() << "DHT: Socket state changed: " << _socket.state();
+Node::nodeReachableEvent(const NodeItem &node) {
+  Network::nodeReachableEvent(node);
+  // Once the first node replied, wait shortly for more seeds before starting the lookups
+  if ((BOOTSTRAP_CONTACT == _bootstrapStage) && (! _bootstrapDelayTimer.isActive())) {
+    _bootstrapDelayTimer.start();
+  }
+}
+
+bool
+Node::joining() const {
+  return (BOOTSTRAP_IDLE != _bootstrapStage) && (BOOTSTRAP_READY != _bootstrapStage);
+}
+
+void
+Node::_onBootstrapLookups() {
+  if (BOOTSTRAP_CONTACT != _bootstrapStage)
+    return;
+  QList<NodeItem> nodes;
+  _buckets.getNearest(_self.id(), nodes);
+  if (nodes.isEmpty())
+    return;
+  qint64 now = _clock.elapsed();
+  logInfo() << "Bootstrap: Contacted " << nodes.size() << " nodes after "
+            << (now-_bootstrapStageStarted) << "ms, search for myself.";
+  _bootstrapStage = BOOTSTRAP_LOOKUP;
+  _bootstrapStageStarted = now;
+  _bootstrapTimer.start();
+  // Split the nearest nodes round-robin among the self-lookups, hence they take disjoint paths at
+  // first and the neighbourhood is found even if some paths run into dead ends
+  int n = std::min(NODE_BOOTSTRAP_SELF_LOOKUPS, nodes.size());
+  QVector<QList<NodeItem> > start(n);
+  for (int i=0; i<nodes.size(); i++) {
+    start[i % n].append(nodes[i]);
+  }
+  QList<SearchQuery *> queries;
+  for (int i=0; i<n; i++) {
+    queries.append(_newBootstrapLookup(_self.id(), start[i]));
+  }
+  // Start lookups once all are registered, as a lookup may complete immediately
+  foreach (SearchQuery *query, queries) {
+    continueSearch(query);
+  }
+}
+
+SearchQuery *
+Node::_newBootstrapLookup(const Identifier &id, const QList<NodeItem> &nodes) {
+  NeighbourhoodQuery *query = new NeighbourhoodQuery(id);
+  query->ignore(_self.id());
+  foreach (const NodeItem &node, nodes) {
+    query->update(node, rtt(node.id()));
+  }
+  connect(query, SIGNAL(succeeded(Identifier,QList<NodeItem>)), this, SLOT(_onBootstrapLookupDone()));
+  connect(query, SIGNAL(failed(Identifier,QList<NodeItem>)), this, SLOT(_onBootstrapLookupDone()));
+  _bootstrapQueries.insert(query);
+  return query;
+}
+
+void
+Node::_onBootstrapLookupDone() {
+  // Ignore lookups of a previous stage
+  if (! _bootstrapQueries.remove(static_cast<SearchQuery *>(sender())))
+    return;
+  if (_bootstrapQueries.size())
+    return;
+
+  qint64 now = _clock.elapsed();
+  if (BOOTSTRAP_LOOKUP == _bootstrapStage) {
+    QList<size_t> indices;
+    _buckets.getUnderpopulated(indices);
+    logInfo() << "Bootstrap: Found neighbourhood after " << (now-_bootstrapStageStarted)
+              << "ms, refresh " << indices.size() << " buckets.";
+    if (indices.isEmpty()) {
+      _bootstrapReady();
+      return;
+    }
+    _bootstrapStage = BOOTSTRAP_REFRESH;
+    _bootstrapStageStarted = now;
+    _bootstrapTimer.start();
+    // Search random identifiers within all under-populated buckets in parallel
+    QList<SearchQuery *> queries;
+    foreach (size_t index, indices) {
+      Identifier id = _buckets.randomId(index);
+      QList<NodeItem> nodes;
+      _buckets.getNearest(id, nodes);
+      queries.append(_newBootstrapLookup(id, nodes));
+    }
+    foreach (SearchQuery *query, queries) {
+      continueSearch(query);
+    }
+  } else if (BOOTSTRAP_REFRESH == _bootstrapStage) {
+    logInfo() << "Bootstrap: Refreshed buckets after " << (now-_bootstrapStageStarted) << "ms.";
+    _bootstrapReady();
+  }
+}
+
+void
+Node::_onBootstrapTimeout() {
+  if (BOOTSTRAP_CONTACT == _bootstrapStage) {
+    // Seeds may not be up yet -> try again
+    logWarning() << "Bootstrap: No node reachable yet, contact seeds again.";
+    for (int i=0; i<_bootstrapSeeds.size(); i++) {
+      ping(_bootstrapSeeds[i].first, _bootstrapSeeds[i].second);
+    }
+    _bootstrapTimer.start();
+  } else if ((BOOTSTRAP_LOOKUP == _bootstrapStage) || (BOOTSTRAP_REFRESH == _bootstrapStage)) {
+    // Do not wait for slow lookups, the buckets are filled by the replies anyway
+    logWarning() << "Bootstrap: " << _bootstrapQueries.size() << " lookups timed out.";
+    _bootstrapQueries.clear();
+    _bootstrapReady();
+  }
+}
+
+void
+Node::_bootstrapReady() {
+  _bootstrapStage = BOOTSTRAP_READY;
+  _bootstrapTimer.stop();
+  _bootstrapQueries.clear();
+  _timeToReady = _clock.elapsed() - _bootstrapStarted;
+  logInfo() << "Bootstrap: Joined network after " << _timeToReady << "ms with "
+            << numNodes() << " nodes in " << numBuckets() << " buckets.";
+  emit ready();
+}
+
+void
+Node::_onEventLoopAwake() {
+  Ticks::update();
+}
+
+void
+Node::_onDrainSendQueue() {
+  qint64 now = _clock.elapsed();
+  QList<Identifier> writable;
+  // Visit every destination with queued datagrams once
+  int n = _activeDestinations.size();
+  for (int i=0; i<n; i++) {
+    PeerItem peer = _activeDestinations.takeFirst();
+    Destination &dest = _destinations[peer];
+    // Refill token bucket
+    if (0 == _pacingRate) {
+      dest.tokens = _pacingBurst;
+    } else {
+      dest.tokens = std::min(double(_pacingBurst),
+                             dest.tokens + double(_pacingRate)*(now-dest.lastRefill)/1000);
+    }
+    dest.lastRefill = now;
+    // Send as many datagrams as the budget allows
+    bool stalled = false;
+    while ((! dest.queue.isEmpty()) && (dest.tokens >= dest.queue.first().size())) {
+      const QByteArray &dgram = dest.queue.first();
+      if (! _transport->send((const uint8_t *)dgram.constData(), dgram.size(),
+                             peer.addr(), peer.port())) {
+        // Transport buffer is full -> retry later
+        stalled = true;
+        break;
+      }
+      dest.tokens -= dgram.size();
+      dest.queue.removeFirst();
+      _queuedDatagrams--;
+    }
+    // Release backpressure once the queue drained to a quarter
+    if (dest.congested && (dest.queue.size() <= NODE_SEND_QUEUE_SIZE/4)) {
+      dest.congested = false;
+      writable.append(dest.blocked);
+      dest.blocked.clear();
+    }
+    if (! dest.queue.isEmpty()) {
+      _activeDestinations.append(peer);
+    }
+    if (stalled) { break; }
+  }
+
+  if (_activeDestinations.size()) {
+    _sendTimer.start(NODE_PACING_INTERVAL);
+  }
+
+  // Notify streams, they may send again
+  foreach (const Identifier &id, writable) {
+    const CookieTable::Entry *entry = _cookies.find(id.constData());
+    if (entry && (CookieTable::STREAM == entry->type)) {
+      entry->stream()->writableEvent();
+    }
+  }
+}
+
+void
+Node::_onHostResolved(const QHostInfo &info) {
+  QList<uint16_t> ports = _pendingLookups.take(info.hostName());
+  if (QHostInfo::NoError != info.error()) {
+    logInfo() << "Cannot resolve " << info.hostName() << ": " << info.errorString();
+  }
+
+  // Drop expired entries and cache the result
+  qint64 now = _clock.elapsed();
+  QHash<QString, HostCacheEntry>::iterator entry = _hostCache.begin();
+  while (entry != _hostCache.end()) {
+    if (entry->expires <= now) { entry = _hostCache.erase(entry); }
+    else { entry++; }
+  }
+  HostCacheEntry result;
+  result.addresses = info.addresses();
+  result.expires = now + (result.addresses.isEmpty() ?
+                            NODE_HOST_CACHE_NEGATIVE_TTL : NODE_HOST_CACHE_TTL);
+  _hostCache.insert(info.hostName(), result);
+
+  // Ping all resolved addresses
+  foreach (uint16_t port, ports) {
+    foreach (QHostAddress addr, result.addresses) {
+      ping(addr, port);
+    }
+  }
+
+  // Query the TTL of the DNS records in the background, unless the name is unqualified (e.g.,
+  // localhost or a LAN name) and hence unlikely known to DNS
+  if (result.addresses.isEmpty() || (! info.hostName().contains('.'))) { return; }
+  QDnsLookup::Type type = (QAbstractSocket::IPv4Protocol == result.addresses.first().protocol()) ?
+        QDnsLookup::A : QDnsLookup::AAAA;
+  QDnsLookup *query = new QDnsLookup(type, info.hostName(), this);
+  connect(query, SIGNAL(finished()), this, SLOT(_onDnsLookupFinished()));
+  query->lookup();
+}
+
+void
+Node::_onDnsLookupFinished() {
+  QDnsLookup *query = qobject_cast<QDnsLookup *>(sender());
+  if (0 == query) { return; }
+  query->deleteLater();
+  // Names not known to DNS (e.g., from /etc/hosts) keep the default lifetime
+  if ((QDnsLookup::NoError != query->error()) || query->hostAddressRecords().isEmpty()) { return; }
+  QHash<QString, HostCacheEntry>::iterator entry = _hostCache.find(query->name());
+  if (entry == _hostCache.end()) { return; }
+
+  // Cache the addresses for the smallest TTL of the records
+  qint64 ttl = NODE_HOST_CACHE_MAX_TTL;
+  foreach (QDnsHostAddressRecord record, query->hostAddressRecords()) {
+    ttl = std::min(ttl, qint64(record.timeToLive())*1000);
+  }
+  entry->expires = _clock.elapsed() + std::max(qint64(NODE_HOST_CACHE_MIN_TTL), ttl);
 }
 
 void
 Node::_processPingResponse(const struct Message &msg, size_t size, PingRequest *req,
                            const QHostAddress &addr, uint16_t port)
 {
+  if (OVL_PING_RESP_SIZE != size) {
+    logInfo() << "Received a malformed Ping response from " << addr << ":" << port;
+    _metrics.countDrop(NodeMetrics::DROP_MALFORMED);
+    return;
+  }
   // check if network identifier of response matches request network
   Identifier remoteNetId(msg.payload.ping.network);
   if (remoteNetId != req->netid())
     return;
   // Irrespective of the network, handle node reachable event
   this->nodeReachableEvent(NodeItem(Identifier(msg.payload.ping.id), addr, port));
+  // Update RTT estimate of the node
+  _addRttSample(req, Identifier(msg.payload.ping.id));
   // Then, check if network is known
   if (! _networks.contains(remoteNetId))
     return;
@@ -739,44 +1659,44 @@ void
 Node::_processSearchResponse(
     const struct Message &msg, size_t size, SearchRequest *req, const QHostAddress &addr, uint16_t port)
 {
+  // Update RTT estimate of the node queried, the response proves its liveness
+  _addRttSample(req, req->to());
+  _touch(req->to(), PeerItem(addr, port));
+  SearchQuery *query = req->query();
+  query->requestFinished();
   // payload length must be a multiple of triple length
   if ( 0 == ((size-OVL_SEARCH_MIN_RESP_SIZE)%OVL_TRIPLE_SIZE) ) {
     // unpack and update query
     size_t Ntriple = (size-OVL_SEARCH_MIN_RESP_SIZE)/OVL_TRIPLE_SIZE;
     for (size_t i=0; i<Ntriple; i++) {
       Identifier id(msg.payload.result.triples[i].id);
-      NodeItem item(id, QHostAddress((const Q_IPV6ADDR &)*(msg.payload.result.triples[i].ip)),
-                    ntohs(msg.payload.result.triples[i].port));
+      NodeItem item(id, PeerItem((const uint8_t *)msg.payload.result.triples[i].ip,
+                                 ntohs(msg.payload.result.triples[i].port)));
       // Add discovered node to buckets
-      _buckets.addCandidate(id, item.addr(), item.port());
+      _buckets.addCandidate(item);
       // add candidate for the specific network
-      if (_networks.contains(req->query()->netid()))
-        _networks[req->query()->netid()]->addCandidate(item);
-      // Update node list of query
-      req->query()->update(item);
-    }
-
-    // If the search has been completed -> done
-    if (req->query()->isSearchComplete()) {
-      req->query()->searchCompleted();
-      return;
+      if (_networks.contains(query->netid()))
+        _networks[query->netid()]->addCandidate(item);
+      // Update node list of query, unless it is finished already
+      if (! query->isFinished())
+        query->update(item, rtt(item.id()));
     }
   } else {
     logInfo() << "Received a malformed Search response from "
               << addr << ":" << port;
+    _metrics.countDrop(NodeMetrics::DROP_MALFORMED);
   }
-  // Get next node to query
-  NodeItem next;
-  // get next node to query, if there is no next node -> search failed
-  if (! req->query()->next(next)) {
-    // delete query
-    req->query()->searchCompleted();
-    // done.
+
+  // If the query has been finished by another response -> done
+  if (query->isFinished())
+    return;
+  // If the search has been completed -> done
+  if (query->isSearchComplete()) {
+    query->searchCompleted();
     return;
   }
-
-  // Send next request
-  sendSearch(next, req->query());
+  // Send next requests
+  continueSearch(query);
 }
 
 void
@@ -800,8 +1720,15 @@ Node::_processStartConnectionResponse(
     return;
   }
 
+  // The cookie becomes the stream id, refuse it if taken by another stream meanwhile
+  if (_cookies.find(req->cookie())) {
+    logError() << "Cookie of connection id=" << req->socket()->id().toBase32() << " is in use.";
+    req->socket()->failed();
+    return;
+  }
+
   // success -> start connection
-  if (! req->socket()->start(req->cookie(), PeerItem(addr, port))) {
+  if (! req->socket()->start(Identifier(req->cookie()), PeerItem(addr, port))) {
     logError() << "Can not initialize symmetric chipher for connection id="
                << req->socket()->id().toBase32() << ".";
     req->socket()->failed();
@@ -809,7 +1736,9 @@ Node::_processStartConnectionResponse(
   }
 
   // Stream started: register stream
-  _connections[req->cookie()] = req->socket();
+  _cookies.insert(req->cookie(), req->socket());
+  // The peer proved its identity
+  _touch(req->peedId(), PeerItem(addr, port));
 }
 
 void
@@ -822,21 +1751,20 @@ Node::_processPingRequest(
     logDebug() << "Received Ping request from " << Identifier(msg.payload.ping.id)
                << "@" << addr << ":" << port
                << " for unknown network " << remoteNetId << ".";
+    _metrics.countDrop(NodeMetrics::DROP_UNKNOWN_NETWORK);
     // Anyway, add as a candidate to the root network
     _buckets.addCandidate(Identifier(msg.payload.ping.id), addr, port);
     return;
   }
 
   // simply assemble a pong response including my own ID
-  Message resp;
-  memcpy(resp.cookie, msg.cookie, OVL_COOKIE_SIZE);
-  memcpy(resp.payload.ping.id, _self.id().constData(), OVL_HASH_SIZE);
-  memcpy(resp.payload.ping.network, remoteNetId.constData(), OVL_HASH_SIZE);
-  resp.payload.ping.type = Message::PING;
+  size_t resp_size = _txMessage->assemblePing(msg.cookie, _self.id(), remoteNetId);
   // send
   //logDebug() << "Send Ping response to " << addr << ":" << port;
-  if(0 > _socket.writeDatagram((char *) &resp, OVL_PING_RESP_SIZE, addr, port)) {
+  if (! _transport->send((const uint8_t *) _txMessage, resp_size, addr, port)) {
     logError() << "Failed to send Ping response to " << addr << ":" << port;
+  } else {
+    _metrics.countOut(NodeMetrics::PING);
   }
 
   // Add node to candidate nodes for the specific network
@@ -852,31 +1780,64 @@ Node::_processSearchRequest(
   Identifier remoteNetId(msg.payload.search.network);
   if (!_networks.contains(remoteNetId)) {
     logDebug() << "Cannot process search request: Unknown network " << remoteNetId;
+    _metrics.countDrop(NodeMetrics::DROP_UNKNOWN_NETWORK);
     return;
   }
 
-  // Get best matches for the requested network
-  QList<NodeItem> best;
-  _networks[remoteNetId]->getNearest(Identifier(msg.payload.search.id), best);
-
-  struct Message resp;
+  Message &resp = *_txMessage;
   // Assemble response
   memcpy(resp.cookie, msg.cookie, OVL_COOKIE_SIZE);
+
+  // Lookup cached response, valid as long as the routing table did not change
+  Network *network = _networks[remoteNetId];
+  QPair<Identifier, Identifier> key(remoteNetId, Identifier(msg.payload.search.id));
+  qint64 now = _clock.elapsed();
+  QHash<QPair<Identifier, Identifier>, SearchCacheEntry>::iterator entry = _searchCache.find(key);
+  bool hit = (entry != _searchCache.end()) && (entry->expires > now) &&
+      (entry->version == network->_buckets.version());
+  if (entry != _searchCache.end()) {
+    // Mark entry as most recently used
+    _searchCacheOrder.splice(_searchCacheOrder.end(), _searchCacheOrder, entry->order);
+  }
+  if (! hit) {
+    // Get best matches for the requested network
+    QList<NodeItem> best;
+    network->getNearest(key.second, best);
+    if (entry == _searchCache.end()) {
+      // Evict the least recently used entry if the cache is full
+      if (_searchCache.size() >= NODE_SEARCH_CACHE_SIZE) {
+        _searchCache.remove(_searchCacheOrder.front());
+        _searchCacheOrder.pop_front();
+      }
+      entry = _searchCache.insert(key, SearchCacheEntry());
+      entry->order = _searchCacheOrder.insert(_searchCacheOrder.end(), key);
+    }
+    // Encode all triples into the response and keep a copy
+    int n = std::min(best.size(), int(OVL_MAX_K));
+    QList<NodeItem>::iterator item = best.begin();
+    for (int i = 0; i<n; item++, i++) {
+      memcpy(resp.payload.result.triples[i].id, item->id().data(), OVL_HASH_SIZE);
+      memcpy(resp.payload.result.triples[i].ip, item->ip(), 16);
+      resp.payload.result.triples[i].port = htons(item->port());
+    }
+    memcpy(entry->triples, resp.payload.result.triples, n*OVL_TRIPLE_SIZE);
+    entry->version = network->_buckets.version();
+    entry->expires = now + NODE_SEARCH_CACHE_TTL;
+    entry->count = n;
+  }
+
   // Determine the number of nodes to reply
   int maxN = int(size-OVL_SEARCH_MIN_REQU_SIZE)/OVL_TRIPLE_SIZE;
-  int N = std::min(best.size(), maxN);
-
-  // Add items
-  QList<NodeItem>::iterator item = best.begin();
-  for (int i = 0; (item!=best.end()) && (i<N); item++, i++) {
-    memcpy(resp.payload.result.triples[i].id, item->id().data(), OVL_HASH_SIZE);
-    memcpy(resp.payload.result.triples[i].ip, item->addr().toIPv6Address().c, 16);
-    resp.payload.result.triples[i].port = htons(item->port());
+  int N = std::min(entry->count, maxN);
+  if (hit) {
+    memcpy(resp.payload.result.triples, entry->triples, N*OVL_TRIPLE_SIZE);
   }
 
   // Compute size and send reponse
   size_t resp_size = (OVL_SEARCH_MIN_RESP_SIZE + N*OVL_TRIPLE_SIZE);
-  _socket.writeDatagram((char *) &resp, resp_size, addr, port);
+  if (_transport->send((const uint8_t *) &resp, resp_size, addr, port)) {
+    _metrics.countOut(NodeMetrics::SEARCH);
+  }
 }
 
 void
@@ -906,6 +1867,7 @@ Node::_processStartConnectionRequest(const Message &msg, size_t size, const QHos
   }
 
   // assemble response
+  // The connection may send data once started, hence the response is assembled on the stack
   Message resp; int keyLen=0;
   memcpy(resp.cookie, msg.cookie, OVL_COOKIE_SIZE);
   resp.payload.start_connection.type = Message::CONNECT;
@@ -916,6 +1878,12 @@ Node::_processStartConnectionRequest(const Message &msg, size_t size, const QHos
     delete connection; return;
   }
 
+  // The cookie becomes the stream id, refuse it if it belongs to a stream or a request
+  if (_cookies.find(resp.cookie)) {
+    logInfo() << "Refuse connection from " << addr << ":" << port << ": Cookie in use.";
+    delete connection; return;
+  }
+
   if (! connection->start(Identifier(resp.cookie), PeerItem(addr, port))) {
     logError() << "Can not finish SecureSocket handshake.";
     delete connection; return;
@@ -924,13 +1892,14 @@ Node::_processStartConnectionRequest(const Message &msg, size_t size, const QHos
   // compute message size
   keyLen += OVL_CONNECT_MIN_RESP_SIZE;
   // Send response
-  if (keyLen != _socket.writeDatagram((char *)&resp, keyLen, addr, port)) {
+  if (! _transport->send((const uint8_t *)&resp, keyLen, addr, port)) {
     logError() << "Can not send StartConnection response";
     delete connection; return;
   }
+  _metrics.countOut(NodeMetrics::CONNECT);
 
   // Connection started..
-  _connections[Identifier(resp.cookie)] = connection;
+  _cookies.insert(resp.cookie, connection);
   serviceHandler->connectionStarted(connection);
 }
 
@@ -939,33 +1908,114 @@ Node::_processRendezvousRequest(Message &msg, size_t size, const QHostAddress &a
   if (_self.id() == Identifier(msg.payload.rendezvous.id)) {
     logDebug() << "Received rendezvous request -> ping back.";
     // If the rendezvous request addressed me -> response with a ping
-    ping(msg.payload.rendezvous.ip, ntohs(msg.payload.rendezvous.port));
+    ping(PeerItem((const uint8_t *)msg.payload.rendezvous.ip, ntohs(msg.payload.rendezvous.port)));
   } else if (_buckets.contains(Identifier(msg.payload.rendezvous.id))) {
     // If the rendezvous request is not addressed to me but to a node I know -> forward
     NodeItem node = _buckets.getNode(Identifier(msg.payload.rendezvous.id));
     memcpy(msg.payload.rendezvous.ip, addr.toIPv6Address().c, 16);
     msg.payload.rendezvous.port = htons(port);
     logDebug() << "Forward rendezvous to " << node.id() << ".";
-    if (OVL_RENDEZVOUS_REQU_SIZE != _socket.writeDatagram(
-          (char *)&msg, OVL_RENDEZVOUS_REQU_SIZE, node.addr(), node.port())) {
+    if (! _transport->send((const uint8_t *)&msg, OVL_RENDEZVOUS_REQU_SIZE, node.addr(), node.port())) {
       logError() << "DHT: Cannot forward rendezvous request to " << node.id()
                  << " @" << node.addr() << ":" << node.port();
+    } else {
+      _metrics.countOut(NodeMetrics::RENDEZVOUS);
     }  
   }
   // silently ignore rendezvous requests to an unknown node.
 }
 
+void
+Node::_addPendingRequest(Request *req, const Identifier &peer) {
+  if (! _cookies.insert(req->cookie(), req)) {
+    // The request cannot be answered and will time out
+    logWarning() << "Cookie of request is in use by a stream.";
+  }
+  // Insert into the slot of the first tick not before the deadline
+  req->_sent = _clock.nsecsElapsed()/1000;
+  req->_deadline = _clock.elapsed() + requestTimeout(peer);
+  size_t slot = ((req->_deadline+NODE_REQUEST_CHECK_INTERVAL-1)/NODE_REQUEST_CHECK_INTERVAL)
+      & (NODE_REQUEST_WHEEL_SIZE-1);
+  req->_prev = 0;
+  req->_next = _requestWheel[slot];
+  if (req->_next) { req->_next->_prev = req; }
+  _requestWheel[slot] = req;
+}
+
+void
+Node::_addRttSample(Request *req, const Identifier &peer) {
+  qint64 rtt = _clock.nsecsElapsed()/1000 - req->sent();
+  _metrics.requestRtt().record(rtt);
+  QHash<Identifier, Network *>::iterator network = _networks.begin();
+  for (; network != _networks.end(); network++) {
+    (*network)->_buckets.addRttSample(peer, rtt/1000);
+  }
+}
+
+bool
+Node::_rtt(const Identifier &id, int &srtt, int &rttvar) const {
+  QHash<Identifier, Network *>::const_iterator network = _networks.begin();
+  for (; network != _networks.end(); network++) {
+    if ((*network)->_buckets.rtt(id, srtt, rttvar)) { return true; }
+  }
+  return false;
+}
+
+void
+Node::_touch(const Identifier &id, const PeerItem &peer) {
+  QHash<Identifier, Network *>::iterator network = _networks.begin();
+  for (; network != _networks.end(); network++) {
+    (*network)->_buckets.touch(id, peer);
+  }
+}
+
+void
+Node::_removePendingRequest(Request *req) {
+  _cookies.remove(req->cookie(), CookieTable::REQUEST);
+  // Unlink from timing wheel
+  if (req->_prev) {
+    req->_prev->_next = req->_next;
+  } else {
+    size_t slot = ((req->_deadline+NODE_REQUEST_CHECK_INTERVAL-1)/NODE_REQUEST_CHECK_INTERVAL)
+        & (NODE_REQUEST_WHEEL_SIZE-1);
+    _requestWheel[slot] = req->_next;
+  }
+  if (req->_next) { req->_next->_prev = req->_prev; }
+  req->_prev = req->_next = 0;
+}
+
+void
+Node::_freeRequest(Request *req) {
+  if (Request::PING == req->type()) {
+    static_cast<PingRequest *>(req)->~PingRequest();
+  } else if (Request::SEARCH == req->type()) {
+    static_cast<SearchRequest *>(req)->~SearchRequest();
+  } else if (Request::START_CONNECTION == req->type()) {
+    static_cast<StartConnectionRequest *>(req)->~StartConnectionRequest();
+  }
+  _requestPool->free(req);
+}
+
 void
 Node::_onCheckRequestTimeout() {
-  // Remove dead requests from pending request list
+  qint64 now = _clock.elapsed();
+  qint64 tick = now/NODE_REQUEST_CHECK_INTERVAL;
+  // Visit all slots passed since the last check, but each slot at most once
+  qint64 first = std::max(_wheelTick+1, tick-NODE_REQUEST_WHEEL_SIZE+1);
+  _wheelTick = tick;
+
+  // Collect dead requests from the passed slots, requests due in a later round of the wheel
+  // remain in their slot
   QList<Request *> deadRequests;
-  QHash<Identifier, Request *>::iterator item = _pendingRequests.begin();
-  while (item != _pendingRequests.end()) {
-    if ((*item)->olderThan(2000)) {
-      deadRequests.append(*item);
-      item = _pendingRequests.erase(item);
-    } else {
-      item++;
+  for (qint64 t=first; t<=tick; t++) {
+    Request *req = _requestWheel[t & (NODE_REQUEST_WHEEL_SIZE-1)];
+    while (req) {
+      Request *next = req->_next;
+      if (req->_deadline <= now) {
+        _removePendingRequest(req);
+        deadRequests.append(req);
+      }
+      req = next;
     }
   }
 
@@ -974,28 +2024,26 @@ Node::_onCheckRequestTimeout() {
   for (; req != deadRequests.end(); req++) {
     if (Request::PING == (*req)->type()) {
       logDebug() << "Ping request timeout...";
-      delete static_cast<PingRequest *>(*req);
+      PingRequest *ping = static_cast<PingRequest *>(*req);
+      // If a known node did not answer -> replace it if silent
+      if (ping->id().isValid() && _networks.contains(ping->netid())) {
+        _networks[ping->netid()]->nodeUnreachableEvent(ping->id());
+      }
+      _freeRequest(ping);
     } else if (Request::SEARCH == (*req)->type()) {
       logDebug() << "Search request timeout...";
       SearchQuery *query = static_cast<SearchRequest *>(*req)->query();
-      // Get next node to query
-      NodeItem next;
-      // get next node to query, if there is no next node -> search failed
-      if (! query->next(next)) {
-        query->searchCompleted();
-        // delete request and query
-        delete *req;
-      } else {
-        // Continue search
-        sendSearch(next, query);
-        delete *req;
-      }
+      query->requestFinished();
+      // Continue search with the next nodes, unless the query is finished already
+      if (! query->isFinished())
+        continueSearch(query);
+      _freeRequest(*req);
     } else if (Request::START_CONNECTION == (*req)->type()) {
       logDebug() << "StartConnection request timeout...";
       // signal timeout
       static_cast<StartConnectionRequest *>(*req)->socket()->failed();
       // delete request
-      delete *req;
+      _freeRequest(*req);
     }
   }
 }
@@ -1017,4 +2065,15 @@ Node::_onUpdateStatistics() {
   _lastBytesReceived = _bytesReceived;
   _outRate = (double(_bytesSend - _lastBytesSend)/_statisticsTimer.interval())*1000;
   _lastBytesSend = _bytesSend;
+  // Forget idle destinations
+  qint64 now = _clock.elapsed();
+  QHash<PeerItem, Destination>::iterator dest = _destinations.begin();
+  while (dest != _destinations.end()) {
+    if (dest->queue.isEmpty() && (! dest->congested) &&
+        ((now-dest->lastRefill) > NODE_DESTINATION_TIMEOUT)) {
+      dest = _destinations.erase(dest);
+    } else {
+      dest++;
+    }
+  }
 }
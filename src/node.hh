@@ -3,19 +3,25 @@
 
 #include "crypto.hh"
 #include "network.hh"
+#include "transport.hh"
+#include "cookietable.hh"
+#include "metrics.hh"
 
 #include <inttypes.h>
+#include <list>
 
 #include <QObject>
-#include <QUdpSocket>
 #include <QPair>
 #include <QVector>
 #include <QSet>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QHostInfo>
 
 // Forward declarations
 struct Message;
 class Request;
+class RequestPool;
 class PingRequest;
 class SearchRequest;
 class StartConnectionRequest;
@@ -30,13 +36,21 @@ class Node: public Network
   Q_OBJECT
 
 public:
-  /** Constructor.
+  /** Constructor, the node uses a @c UdpTransport.
    * @param id Weak reference to the identity of the node.
    * @param addr Specifies the network address the node will bind to.
    * @param port Specifies the network port the node will listen on.
    * @param parent Optional pararent object. */
   explicit Node(const Identity &id, const QHostAddress &addr=QHostAddress::Any,
                quint16 port=7741, QObject *parent=0);
+  /** Constructor using the given transport.
+   * @param id Weak reference to the identity of the node.
+   * @param transport Specifies the datagram transport, the ownership is taken by the node.
+   * @param addr Specifies the network address the node will bind to.
+   * @param port Specifies the network port the node will listen on.
+   * @param parent Optional pararent object. */
+  Node(const Identity &id, AbstractTransport *transport, const QHostAddress &addr=QHostAddress::Any,
+       quint16 port=7741, QObject *parent=0);
 
 
   /** Destructor. */
@@ -50,6 +64,10 @@ public:
   const Identifier &id() const;
   /** Returns @c true if the socket is listening on the specified port. */
   bool started() const;
+  /** Returns a weak reference to the datagram transport of the node. */
+  AbstractTransport &transport();
+  /** Sets the maximum number of datagrams received (and send) at once by the transport. */
+  void setBatchSize(size_t n);
 
   /** Returns the number of bytes send. */
   size_t bytesSend() const;
@@ -59,6 +77,8 @@ public:
   double inRate() const;
   /** Returns the upload rate. */
   double outRate() const;
+  /** Returns the message counters and latency histograms of the node. */
+  const NodeMetrics &metrics() const;
 
   /** Returns a weak reference to the root network node. */
   Node &root();
@@ -66,13 +86,18 @@ public:
   const QString &prefix() const;
   /** Returns @c true if the given network is registered. */
   bool hasNetwork(const QString &prefix) const;
+  /** Returns @c true if the given network identifier is registered. */
+  bool hasNetwork(const Identifier &netid) const;
   /** Registers a network with the node. */
   bool registerNetwork(Network *subnet);
   /** Returns the network registered with the given prefix. */
   Network *network(const QString &prefix);
+  /** Returns the network registered with the given network identifier or 0 if unknown. */
+  Network *network(const Identifier &netid);
 
   /** Sends a ping to the given hostname and port.
-   * On success, the @c nodeReachable signal gets emitted. */
+   * The hostname is resolved asynchronously, resolved addresses are cached for
+   * some minutes. On success, the @c nodeReachable signal gets emitted. */
   void ping(const QString &addr, uint16_t port);
   /** Sends a ping to the given peer.
    * On success, the @c nodeReachable signal gets emitted. */
@@ -90,6 +115,47 @@ public:
   size_t numNodes() const;
   /** Returns the list of all nodes in the buckets. */
   void nodes(QList<NodeItem> &lst);
+  /** Returns the number of non-empty buckets. */
+  size_t numBuckets() const;
+  /** Returns the number of requests waiting for a response. */
+  size_t numPendingRequests() const;
+  /** Returns the smoothed round-trip time in ms to the given node or -1 if unknown. */
+  int rtt(const Identifier &id) const;
+  /** Returns the round-trip time variation in ms of the given node or -1 if unknown. */
+  int rttVariance(const Identifier &id) const;
+  /** Sets the rate in bytes per second and the burst size in bytes, stream data is paced with
+   * towards every destination. A rate of 0 disables pacing, which is the default. */
+  void setPacingRate(size_t rate, size_t burst);
+  /** Returns the number of datagrams queued for sending. */
+  size_t queuedDatagrams() const;
+  /** Returns the timeout in ms of requests to the given node. It is derived from the RTT estimate
+   * of the node or a default timeout if the RTT of the node is unknown. */
+  int requestTimeout(const Identifier &id) const;
+
+  /** Saves the buckets of all networks to the given file. For every confirmed node, the network,
+   * identifier, address, port, the time since it was last seen and its RTT estimate are stored.
+   * The file is replaced atomically. Returns @c false on error. */
+  bool saveSnapshot(const QString &filename) const;
+  /** Loads a snapshot saved by @c saveSnapshot. The nodes are added as candidates to the
+   * registered networks, most recently seen first, and get validated by a paced ping sweep.
+   * Hence the snapshot should be loaded once all subnetworks are registered.
+   * Returns the number of nodes loaded or -1 on error. */
+  int loadSnapshot(const QString &filename);
+  /** Saves a snapshot to the given file periodically and on destruction of the node.
+   * An empty filename disables the snapshots. */
+  void setSnapshotFile(const QString &filename);
+
+  /** Joins the network. All given seeds (hostname and port) and the first nodes loaded from a
+   * snapshot are pinged at once. Once nodes replied, several lookups of this node run in parallel,
+   * each starting from a different subset of the nodes known. Then, random identifiers are looked
+   * up in all under-populated buckets to fill them. Once these lookups completed, the @c ready
+   * signal gets emitted. The seeds are pinged again periodically until a node replied. */
+  void bootstrap(const QList<QPair<QString, uint16_t> > &seeds);
+  /** Returns @c true if the node joined the network, see @c bootstrap. */
+  bool isReady() const;
+  /** Returns the time in ms it took to join the network, see @c bootstrap, or -1 if the node is
+   * not ready yet. */
+  qint64 timeToReady() const;
 
   /** Starts the search for a node with the query. */
   void search(SearchQuery *query);
@@ -119,15 +185,28 @@ public:
 
   /** Retunrs the number of active connections. */
   size_t numSockets() const;
+  /** Returns the number of registered services. */
+  size_t numServices() const;
   /** Starts a secure connection.
    * The ownership of the @c SecureSocket instance is passed to the @c Node and will be deleted if the
    * connection fails. If the connection is established, the ownership of the socket is passed to
    * the serivce handler instance. */
   bool startConnection(const QString &service, const NodeItem &node, SecureSocket *stream);
+  /** Starts a secure connection to the service specified by its identifier
+   * (see @c Identifier::fromName). */
+  bool startConnection(const Identifier &service, const NodeItem &node, SecureSocket *stream);
   /** Unregister a socket with the Node instance. */
   void socketClosed(const Identifier &id);
-  
+
+signals:
+  /** Gets emitted once the node joined the network, see @c bootstrap. */
+  void ready();
+
 protected:
+  /** Continues the join once the first node replied. */
+  void nodeReachableEvent(const NodeItem &node);
+  /** Returns @c true while a join started by @c bootstrap is running. */
+  bool joining() const;
   /** Sends a ping to the given peer to test if he is a member of the given network. */
   void sendPing(const Identifier &id, const QHostAddress &addr, uint16_t port, const Identifier &netid);
   /** Sends a ping to the given peer to test if he is a member of the given network. */
@@ -135,14 +214,51 @@ protected:
   /** Sends a FindNode message to the node @c to to search for the node specified by the @c query.
    * Any response to that request will be forwarded to the specified @c query. */
   void sendSearch(const NodeItem &to, SearchQuery *query);
+  /** Sends search requests to the next nodes of the query until @c SearchQuery::alpha requests
+   * are in flight. If there are neither nodes left to query nor requests in flight, the search
+   * is completed. */
+  void continueSearch(SearchQuery *query);
   /** Sends some data with the given connection id. */
   bool sendData(const Identifier &id, const uint8_t *data, size_t len,
                 const PeerItem &peer);
   /** Sends some data with the given connection id. */
   bool sendData(const Identifier &id, const uint8_t *data, size_t len,
                 const QHostAddress &addr, uint16_t port);
+  /** Returns @c true if the send queue towards the given peer is congested. */
+  bool sendQueueCongested(const PeerItem &peer) const;
+  /** Registers the given stream to be notified by @c SecureSocket::writableEvent once the
+   * congested send queue towards the given peer drained. */
+  void notifyWhenDrained(const Identifier &id, const PeerItem &peer);
 
 private:
+  /** Binds the transport and starts the timers, called by the constructors. */
+  void _init(const QHostAddress &addr, uint16_t port);
+  /** Adds a request to the pending requests and schedules its timeout w.r.t. the RTT estimate
+   * of the given peer. */
+  void _addPendingRequest(Request *req, const Identifier &peer);
+  /** Adds a round-trip time sample of a request answered by the given peer to every network
+   * containing the peer. */
+  void _addRttSample(Request *req, const Identifier &peer);
+  /** Gets the RTT estimate of the given peer from the first network containing it. Returns
+   * @c false if no network has an estimate. */
+  bool _rtt(const Identifier &id, int &srtt, int &rttvar) const;
+  /** Removes a request from the pending requests and cancels its timeout. */
+  void _removePendingRequest(Request *req);
+  /** Destroys a request item and returns it to the request pool. */
+  void _freeRequest(Request *req);
+  /** Refreshes the liveness of the given node in the buckets of all networks. */
+  void _touch(const Identifier &id, const PeerItem &peer);
+  /** Pings the next nodes loaded from a snapshot. */
+  void _sweep(int count);
+  /** Creates a lookup of the join for the given identifier, starting from the given nodes. */
+  SearchQuery *_newBootstrapLookup(const Identifier &id, const QList<NodeItem> &nodes);
+  /** Finishes the join and emits the @c ready signal. */
+  void _bootstrapReady();
+  /** Sends a datagram of the given stream paced or queues it. Returns @c false if the send queue
+   * towards the peer is full. */
+  bool _sendPaced(const Identifier &id, const uint8_t *data, size_t len, const PeerItem &peer);
+  /** Dispatches a received datagram. */
+  void _processDatagram(Message &msg, size_t size, const QHostAddress &addr, uint16_t port);
   /** Processes a Ping response. */
   void _processPingResponse(const Message &msg, size_t size, PingRequest *req,
                             const QHostAddress &addr, uint16_t port);
@@ -178,14 +294,32 @@ private slots:
   void _onUpdateStatistics();
   /** Gets called when some data has been send. */
   void _onBytesWritten(qint64 n);
-  /** Gets called on socket errors. */
-  void _onSocketError(QAbstractSocket::SocketState error);
+  /** Gets called once a hostname lookup finished. */
+  void _onHostResolved(const QHostInfo &info);
+  /** Gets called once the DNS query for the TTL of a resolved hostname finished. */
+  void _onDnsLookupFinished();
+  /** Gets called to send queued datagrams. */
+  void _onDrainSendQueue();
+  /** Gets called once per iteration of the event loop to advance the coarse clock. */
+  void _onEventLoopAwake();
+  /** Gets called periodically to save a snapshot of the buckets. */
+  void _onSaveSnapshot();
+  /** Gets called periodically to ping the next batch of nodes loaded from a snapshot. */
+  void _onPingSweep();
+  /** Gets called shortly after the first node replied to start the self-lookups of the join. */
+  void _onBootstrapLookups();
+  /** Gets called once a lookup of the join completed. */
+  void _onBootstrapLookupDone();
+  /** Gets called if the current stage of the join timed out. */
+  void _onBootstrapTimeout();
 
 protected:
   /** The identifier of the node. */
   Identity _self;
-  /** The network socket. */
-  QUdpSocket _socket;
+  /** The datagram transport. */
+  AbstractTransport *_transport;
+  /** Receive buffers for a batch of datagrams. */
+  QVector<AbstractTransport::Datagram> _rxBatch;
   /** If @c true, the socket was bound to the address and port given to the constructor. */
   bool _started;
 
@@ -207,14 +341,86 @@ protected:
   size_t _lastBytesSend;
   /** The output rate. */
   double _outRate;
+  /** Message counters and latency histograms. */
+  NodeMetrics _metrics;
 
-  /** The list of pending requests. */
-  QHash<Identifier, Request *> _pendingRequests;
 
   /** Table of services. */
   QHash<Identifier, AbstractService *> _services;
-  /** The list of open connection. */
-  QHash<Identifier, SecureSocket *> _connections;
+  /** Open streams and pending requests by cookie. */
+  CookieTable _cookies;
+
+  /** Monotonic clock for request deadlines. */
+  QElapsedTimer _clock;
+  /** Hashed timing wheel of pending requests. Each slot holds an intrusive list of the requests
+   * due at that tick (modulo the wheel size). */
+  QVector<Request *> _requestWheel;
+  /** The last tick processed. */
+  qint64 _wheelTick;
+  /** Reusable buffer to assemble outgoing messages in. */
+  Message *_txMessage;
+  /** Pool of request items. Every node owns its pool, as nodes may live in different threads. */
+  RequestPool *_requestPool;
+
+  /** A cached hostname lookup result. */
+  typedef struct {
+    /** The resolved addresses, empty if the lookup failed. */
+    QList<QHostAddress> addresses;
+    /** Expiry time of the entry in ms w.r.t. the node clock. */
+    qint64 expires;
+  } HostCacheEntry;
+  /** Cache of resolved hostnames. */
+  QHash<QString, HostCacheEntry> _hostCache;
+  /** Ports to ping for each hostname being resolved. */
+  QHash<QString, QList<uint16_t> > _pendingLookups;
+
+  /** A cached response to a search request. */
+  typedef struct {
+    /** The version of the routing table of the network the response was computed from. */
+    quint64 version;
+    /** Expiry time of the entry in ms w.r.t. the node clock. */
+    qint64 expires;
+    /** The number of triples. */
+    int count;
+    /** The encoded triples, nearest first. */
+    char triples[OVL_MAX_K*OVL_TRIPLE_SIZE];
+    /** The position of the entry in the LRU order. */
+    std::list< QPair<Identifier, Identifier> >::iterator order;
+  } SearchCacheEntry;
+  /** Cache of search responses by network and target identifier. */
+  QHash<QPair<Identifier, Identifier>, SearchCacheEntry> _searchCache;
+  /** The keys of the cached search responses, least recently used first. A linked list, as entries
+   * are moved to the back on every use. */
+  std::list< QPair<Identifier, Identifier> > _searchCacheOrder;
+
+  /** Outbound state of a destination. */
+  class Destination {
+  public:
+    /** Constructor. */
+    inline Destination() : tokens(-1), lastRefill(0), congested(false) { }
+    /** The number of bytes, that can be send now, -1 if not initialized. */
+    double tokens;
+    /** Time of the last refill in ms w.r.t. the node clock. */
+    qint64 lastRefill;
+    /** If @c true, the queue was full. */
+    bool congested;
+    /** Queued datagrams. */
+    QList<QByteArray> queue;
+    /** Streams waiting for the queue to drain. */
+    QList<Identifier> blocked;
+  };
+  /** Outbound state of all destinations. */
+  QHash<PeerItem, Destination> _destinations;
+  /** Destinations with queued datagrams, in round-robin order. */
+  QList<PeerItem> _activeDestinations;
+  /** The number of datagrams queued. */
+  size_t _queuedDatagrams;
+  /** The pacing rate in bytes per second. */
+  size_t _pacingRate;
+  /** The pacing burst size in bytes. */
+  size_t _pacingBurst;
+  /** Timer to send queued datagrams. */
+  QTimer _sendTimer;
 
   /** Timer to check timeouts of requests. */
   QTimer _requestTimer;
@@ -223,6 +429,40 @@ protected:
   /** Timer to update i/o statistics every 5 seconds. */
   QTimer _statisticsTimer;
 
+  /** The file, snapshots of the buckets are saved to. */
+  QString _snapshotFile;
+  /** Timer to save snapshots. */
+  QTimer _snapshotTimer;
+  /** Nodes loaded from a snapshot still to be pinged and the networks they belong to. */
+  QList<QPair<Identifier, NodeItem> > _pingSweep;
+  /** Timer to ping the nodes loaded from a snapshot in batches. */
+  QTimer _pingSweepTimer;
+
+  /** The stages of the join, see @c bootstrap. */
+  typedef enum {
+    BOOTSTRAP_IDLE = 0, ///< No join started.
+    BOOTSTRAP_CONTACT,  ///< Seeds and cached peers are pinged.
+    BOOTSTRAP_LOOKUP,   ///< Self-lookups are running.
+    BOOTSTRAP_REFRESH,  ///< Lookups into under-populated buckets are running.
+    BOOTSTRAP_READY     ///< The node joined the network.
+  } BootstrapStage;
+  /** The current stage of the join. */
+  BootstrapStage _bootstrapStage;
+  /** The seeds of the join. */
+  QList<QPair<QString, uint16_t> > _bootstrapSeeds;
+  /** The time in ms w.r.t. the node clock, the join was started at. */
+  qint64 _bootstrapStarted;
+  /** The time in ms w.r.t. the node clock, the current stage was entered at. */
+  qint64 _bootstrapStageStarted;
+  /** The time in ms it took to join the network, -1 if not ready. */
+  qint64 _timeToReady;
+  /** The lookups of the current stage still running. */
+  QSet<SearchQuery *> _bootstrapQueries;
+  /** Timeout of the current stage of the join. */
+  QTimer _bootstrapTimer;
+  /** Delays the self-lookups until more seeds replied. */
+  QTimer _bootstrapDelayTimer;
+
   // Allow SecureSocket to access sendData()
   friend class SecureSocket;
   friend class SubNetwork;
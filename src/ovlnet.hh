@@ -118,6 +118,7 @@
 
 #include "dht_config.hh"
 #include "node.hh"
+#include "batchedudp.hh"
 #include "subnetwork.hh"
 #include "crypto.hh"
 #include "stream.hh"
@@ -127,6 +128,7 @@
 #include "filetransfer.hh"
 #include "socks.hh"
 #include "httpservice.hh"
+#include "httpmetrics.hh"
 
 #include "logger.hh"
 #include "ntp.hh"
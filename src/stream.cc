@@ -26,10 +26,12 @@ struct __attribute__((packed)) Message
     uint8_t  data[DHT_STREAM_MAX_DATA_SIZE];
   } payload;
 
-  /** Constructor. */
-  inline Message(Flags type) {
-    memset(this, 0, sizeof(Message));
-    this->type = type;
+  /** Constructor, only initializes the header. The payload bytes actually send are written by
+   * the caller. */
+  inline Message(Flags type)
+    : type(type), seq(0)
+  {
+    // pass...
   }
 };
 
@@ -514,6 +516,12 @@ qint64
 SecureStream::writeData(const char *data, qint64 len) {
   // shortcut
   if (0 == len) { return 0; }
+  // If the send queue towards the peer is congested -> accept no data for now, writableEvent
+  // gets called once the queue drained
+  if (congested()) {
+    notifyWhenWritable();
+    return 0;
+  }
   // Determine maximum data length as the minimum of
   // maximum length (len), space in output buffer, window-size of the remote,
   // and maximum payload length
@@ -548,10 +556,9 @@ SecureStream::writeData(const char *data, qint64 len) {
     return len;
   }
 
-
-  // on error
-  logError() << "Can not send datagram!";
-  return -1;
+  // The data is in the output buffer and will be resent on timeout
+  logWarning() << "SecureStream: Can not send datagram, retry later.";
+  return len;
 }
 
 qint64
@@ -693,3 +700,10 @@ void
 SecureStream::readyReadEvent() {
   emit readyRead();
 }
+
+void
+SecureStream::writableEvent() {
+  if (OPEN == _state) {
+    this->bytesWrittenEvent(0);
+  }
+}
@@ -248,6 +248,8 @@ protected:
   virtual void bytesWrittenEvent(qint64 bytes);
   /** Emits the @c readyRead event. */
   virtual void readyReadEvent();
+  /** Emits a @c bytesWritten event, as more data can be written once the send queue drained. */
+  virtual void writableEvent();
 
 private slots:
   /** Gets called periodically to keep the connection alive. */
@@ -49,7 +49,7 @@ SubNetwork::search(SearchQuery *query) {
   QList<NodeItem> nodes;
   _buckets.getNearest(query->id(), nodes);
   foreach (NodeItem item, nodes) {
-    query->update(item);
+    query->update(item, _node.rtt(item.id()));
   }
   // Check if search can be performed
   if (0 == query->best().size()) {
@@ -57,7 +57,7 @@ SubNetwork::search(SearchQuery *query) {
     query->searchCompleted();
     return;
   }
-  _node.sendSearch(query->best().first(), query);
+  _node.continueSearch(query);
 }
 
 void
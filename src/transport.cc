@@ -0,0 +1,131 @@
+#include "transport.hh"
+#include "logger.hh"
+
+#include <algorithm>
+
+
+/* ******************************************************************************************** *
+ * Implementation of AbstractTransport
+ * ******************************************************************************************** */
+AbstractTransport::AbstractTransport(QObject *parent)
+  : QObject(parent), _batchSize(OVL_DEFAULT_IO_BATCH_SIZE), _rxCalls(0), _rxDatagrams(0),
+    _txCalls(0), _txDatagrams(0)
+{
+  // pass...
+}
+
+AbstractTransport::~AbstractTransport() {
+  // pass...
+}
+
+size_t
+AbstractTransport::batchSize() const {
+  return _batchSize;
+}
+
+void
+AbstractTransport::setBatchSize(size_t n) {
+  _batchSize = std::max(size_t(1), std::min(n, size_t(OVL_MAX_IO_BATCH_SIZE)));
+}
+
+void
+AbstractTransport::flush() {
+  // pass...
+}
+
+size_t
+AbstractTransport::receiveCalls() const {
+  return _rxCalls;
+}
+
+size_t
+AbstractTransport::datagramsReceived() const {
+  return _rxDatagrams;
+}
+
+double
+AbstractTransport::rxBatchFactor() const {
+  if (0 == _rxCalls) { return 0; }
+  return double(_rxDatagrams)/_rxCalls;
+}
+
+size_t
+AbstractTransport::sendCalls() const {
+  return _txCalls;
+}
+
+size_t
+AbstractTransport::datagramsSent() const {
+  return _txDatagrams;
+}
+
+double
+AbstractTransport::txBatchFactor() const {
+  if (0 == _txCalls) { return 0; }
+  return double(_txDatagrams)/_txCalls;
+}
+
+
+/* ******************************************************************************************** *
+ * Implementation of UdpTransport
+ * ******************************************************************************************** */
+UdpTransport::UdpTransport(QObject *parent)
+  : AbstractTransport(parent), _socket()
+{
+  connect(&_socket, SIGNAL(readyRead()), this, SIGNAL(readyRead()));
+  connect(&_socket, SIGNAL(bytesWritten(qint64)), this, SIGNAL(bytesWritten(qint64)));
+  connect(&_socket, SIGNAL(error(QAbstractSocket::SocketError)),
+          this, SLOT(_onSocketError(QAbstractSocket::SocketError)));
+}
+
+UdpTransport::~UdpTransport() {
+  // pass...
+}
+
+bool
+UdpTransport::bind(const QHostAddress &addr, uint16_t port) {
+  return _socket.bind(addr, port);
+}
+
+bool
+UdpTransport::isBound() const {
+  return _socket.isValid() && (QAbstractSocket::BoundState == _socket.state());
+}
+
+QHostAddress
+UdpTransport::localAddress() const {
+  return _socket.localAddress();
+}
+
+uint16_t
+UdpTransport::localPort() const {
+  return _socket.localPort();
+}
+
+size_t
+UdpTransport::receive(Datagram *batch, size_t n) {
+  size_t i = 0;
+  for (; (i<n) && _socket.hasPendingDatagrams(); i++) {
+    qint64 size = _socket.pendingDatagramSize();
+    _socket.readDatagram((char *) batch[i].data, OVL_MAX_MESSAGE_SIZE,
+                         &batch[i].addr, &batch[i].port);
+    batch[i].size = size;
+    _rxCalls++; _rxDatagrams++;
+  }
+  return i;
+}
+
+bool
+UdpTransport::send(const uint8_t *data, size_t len, const QHostAddress &addr, uint16_t port) {
+  _txCalls++;
+  if (qint64(len) != _socket.writeDatagram((const char *)data, len, addr, port)) {
+    return false;
+  }
+  _txDatagrams++;
+  return true;
+}
+
+void
+UdpTransport::_onSocketError(QAbstractSocket::SocketError error) {
+  logError() << "UdpTransport: Socket error: " << _socket.errorString();
+}
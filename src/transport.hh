@@ -0,0 +1,134 @@
+#ifndef __OVL_TRANSPORT_HH__
+#define __OVL_TRANSPORT_HH__
+
+#include "dht_config.hh"
+
+#include <QObject>
+#include <QHostAddress>
+#include <QUdpSocket>
+
+#include <inttypes.h>
+
+
+/** Abstract interface of a datagram transport used by the @c Node.
+ *
+ * A transport binds to a local address and port, sends datagrams to and receives datagrams from
+ * remote peers. Datagrams are received in batches into buffers provided by the caller. This allows
+ * to implement transports receiving several datagrams with a single system call as well as
+ * in-memory transports for testing.
+ * @ingroup internal */
+class AbstractTransport: public QObject
+{
+  Q_OBJECT
+
+public:
+  /** A received datagram. The buffer is provided by the caller of @c receive. */
+  struct Datagram {
+    /** The datagram data. */
+    uint8_t      data[OVL_MAX_MESSAGE_SIZE];
+    /** The size of the datagram, larger than @c OVL_MAX_MESSAGE_SIZE if it was truncated. */
+    size_t       size;
+    /** The source address. */
+    QHostAddress addr;
+    /** The source port. */
+    uint16_t     port;
+  };
+
+protected:
+  /** Hidden constructor. */
+  explicit AbstractTransport(QObject *parent=0);
+
+public:
+  /** Destructor. */
+  virtual ~AbstractTransport();
+
+  /** Binds the transport to the given address and port. */
+  virtual bool bind(const QHostAddress &addr, uint16_t port) = 0;
+  /** Returns @c true if the transport is bound. */
+  virtual bool isBound() const = 0;
+  /** Returns the local address, the transport is bound to. */
+  virtual QHostAddress localAddress() const = 0;
+  /** Returns the local port, the transport is bound to. */
+  virtual uint16_t localPort() const = 0;
+
+  /** Returns the maximum number of datagrams returned by a single call to @c receive,
+   * @c OVL_DEFAULT_IO_BATCH_SIZE by default. */
+  virtual size_t batchSize() const;
+  /** Sets the maximum number of datagrams returned by a single call to @c receive, limited to
+   * @c OVL_MAX_IO_BATCH_SIZE. */
+  virtual void setBatchSize(size_t n);
+  /** Receives up to @c n datagrams into the given buffers.
+   * Returns the number of datagrams received or 0 if there are no pending datagrams. */
+  virtual size_t receive(Datagram *batch, size_t n) = 0;
+  /** Sends (or queues) a datagram to the given address and port.
+   * Returns @c false if the datagram cannot be send. */
+  virtual bool send(const uint8_t *data, size_t len, const QHostAddress &addr, uint16_t port) = 0;
+
+  /** Returns the number of receive system calls. */
+  size_t receiveCalls() const;
+  /** Returns the number of datagrams received. */
+  size_t datagramsReceived() const;
+  /** Returns the average number of datagrams received per system call. */
+  double rxBatchFactor() const;
+  /** Returns the number of send system calls. */
+  size_t sendCalls() const;
+  /** Returns the number of datagrams send. */
+  size_t datagramsSent() const;
+  /** Returns the average number of datagrams send per system call. */
+  double txBatchFactor() const;
+
+public slots:
+  /** Sends all queued datagrams. The default implementation does nothing. */
+  virtual void flush();
+
+signals:
+  /** Gets emitted if there are datagrams pending. */
+  void readyRead();
+  /** Gets emitted once some datagrams have been send. */
+  void bytesWritten(qint64 bytes);
+
+protected:
+  /** The maximum number of datagrams per call to @c receive. */
+  size_t _batchSize;
+  /** Number of receive calls. */
+  size_t _rxCalls;
+  /** Number of datagrams received. */
+  size_t _rxDatagrams;
+  /** Number of send calls. */
+  size_t _txCalls;
+  /** Number of datagrams send. */
+  size_t _txDatagrams;
+};
+
+
+/** The default datagram transport using a @c QUdpSocket, processing one datagram per system
+ * call.
+ * @ingroup internal */
+class UdpTransport: public AbstractTransport
+{
+  Q_OBJECT
+
+public:
+  /** Constructor. */
+  explicit UdpTransport(QObject *parent=0);
+  /** Destructor. */
+  virtual ~UdpTransport();
+
+  bool bind(const QHostAddress &addr, uint16_t port);
+  bool isBound() const;
+  QHostAddress localAddress() const;
+  uint16_t localPort() const;
+
+  size_t receive(Datagram *batch, size_t n);
+  bool send(const uint8_t *data, size_t len, const QHostAddress &addr, uint16_t port);
+
+private slots:
+  /** Gets called on socket errors. */
+  void _onSocketError(QAbstractSocket::SocketError error);
+
+protected:
+  /** The socket. */
+  QUdpSocket _socket;
+};
+
+#endif // __OVL_TRANSPORT_HH__
@@ -1,5 +1,25 @@
 #include "utils.hh"
 #include "logger.hh"
 #include <cmath>
+#include <QElapsedTimer>
 
 
+/* ******************************************************************************************** *
+ * Implementation of Ticks
+ * ******************************************************************************************** */
+/** Returns a started monotonic clock. */
+static QElapsedTimer
+_startedClock() {
+  QElapsedTimer clock; clock.start();
+  return clock;
+}
+
+/** The monotonic clock the ticks are derived from, started at load time. */
+static const QElapsedTimer _ticksClock = _startedClock();
+
+QAtomicInteger<quint32> Ticks::_now(1);
+
+void
+Ticks::update() {
+  _now.store(1 + quint32(_ticksClock.elapsed()/1000));
+}
@@ -4,6 +4,7 @@
 #include "logger.hh"
 
 #include <inttypes.h>
+#include <QAtomicInteger>
 
 
 /** Returns a random byte.
@@ -34,4 +35,26 @@ inline uint64_t dht_rand64() {
   return (uint64_t(dht_rand32())<<32) + dht_rand32();
 }
 
+
+/** A coarse monotonic clock counting seconds, shared by the routing tables.
+ *
+ * Reading the clock is just a load of an atomic counter, hence table sweeps comparing the age of
+ * many entries are cheap. The counter is advanced by @c update, which gets called by every @c Node
+ * once per iteration of its event loop. As the counter is derived from a monotonic clock, ages
+ * are not affected by changes of the wall-clock time. The first tick is 1, hence a tick of 0 can
+ * be used to represent "never".
+ * @ingroup utils */
+class Ticks
+{
+public:
+  /** Returns the current tick in seconds. */
+  static inline uint32_t now() { return _now.load(); }
+  /** Advances the tick from the monotonic clock. */
+  static void update();
+
+protected:
+  /** The current tick. */
+  static QAtomicInteger<quint32> _now;
+};
+
 #endif // UTILS_H